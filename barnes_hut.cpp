@@ -0,0 +1,317 @@
+#include "stdafx.h"
+#include "barnes_hut.h"
+
+#include <algorithm>
+#include "particles.h"
+#include "renderer.h"
+
+namespace
+{
+	// Matches Params in shaders/barnes_hut.glsl.
+	struct Params
+	{
+		uint32_t count;
+	};
+
+	const int stackSize = 64;
+
+	uint32_t expandBits(uint32_t v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	int leadingZeros(uint32_t v)
+	{
+		int n = 0;
+		for (uint32_t bit = 0x80000000u; bit != 0 && (v & bit) == 0; bit >>= 1)
+			++n;
+		return n;
+	}
+
+	// Same tree as barnes_hut_build.comp, see there.
+	void buildTree(const std::vector<uint32_t>& keys, std::vector<barnes_hut_node>& nodes, ThreadPool& threadPool)
+	{
+		int n = static_cast<int>(keys.size());
+
+		auto delta = [&keys, n](int i, int j)
+		{
+			if (j < 0 || j >= n)
+				return -1;
+			if (keys[i] == keys[j])
+				return 32 + leadingZeros(static_cast<uint32_t>(i ^ j));
+			return leadingZeros(keys[i] ^ keys[j]);
+		};
+
+		threadPool.parallelFor(n - 1, [&](size_t begin, size_t end)
+		{
+			for (int i = static_cast<int>(begin); i < static_cast<int>(end); ++i)
+			{
+				int d = delta(i, i + 1) - delta(i, i - 1) >= 0 ? 1 : -1;
+				int deltaMin = delta(i, i - d);
+
+				int lengthMax = 2;
+				while (delta(i, i + lengthMax * d) > deltaMin)
+					lengthMax *= 2;
+
+				int range = 0;
+				for (int t = lengthMax / 2; t >= 1; t /= 2)
+				{
+					if (delta(i, i + (range + t) * d) > deltaMin)
+						range += t;
+				}
+				int j = i + range * d;
+
+				int deltaNode = delta(i, j);
+				int split = 0;
+				for (int divisor = 2, t = (range + 1) / 2; ; divisor *= 2, t = (range + divisor - 1) / divisor)
+				{
+					if (delta(i, i + (split + t) * d) > deltaNode)
+						split += t;
+					if (t <= 1)
+						break;
+				}
+				int gamma = i + split * d + std::min(d, 0);
+
+				int left = std::min(i, j) == gamma ? n - 1 + gamma : gamma;
+				int right = std::max(i, j) == gamma + 1 ? n - 1 + gamma + 1 : gamma + 1;
+
+				// Every node has one parent, so the writes don't overlap between threads.
+				nodes[i].left = left;
+				nodes[i].right = right;
+				nodes[left].parent = i;
+				nodes[right].parent = i;
+			}
+		});
+
+		nodes[0].parent = -1;
+	}
+
+	void summarize(std::vector<barnes_hut_node>& nodes, int32_t i)
+	{
+		barnes_hut_node& node = nodes[i];
+		if (node.left < 0)
+			return;
+
+		summarize(nodes, node.left);
+		summarize(nodes, node.right);
+
+		const barnes_hut_node& a = nodes[node.left];
+		const barnes_hut_node& b = nodes[node.right];
+
+		float mass = a.com.w + b.com.w;
+		glm::vec3 com = mass > 0.0f ? (glm::vec3(a.com) * a.com.w + glm::vec3(b.com) * b.com.w) / mass : glm::vec3(a.com);
+		node.com = glm::vec4(com, mass);
+		node.boundsMin = glm::min(a.boundsMin, b.boundsMin);
+		node.boundsMax = glm::max(a.boundsMax, b.boundsMax);
+	}
+
+	uint32_t powerOfTwoFloor(uint32_t v)
+	{
+		uint32_t p = 1;
+		while (p * 2 <= v)
+			p *= 2;
+		return p;
+	}
+}
+
+BarnesHut::BarnesHut(uint32_t count, const std::vector<vk::Buffer>& positions, const std::vector<vk::Buffer>& velocities, PipelineLayoutCache& layouts, PipelineRegistry& registry, const BarnesHutParams& params) :
+	m_count(count),
+	m_states(static_cast<uint32_t>(positions.size()))
+{
+	if (count < 2) throw std::runtime_error("Barnes-Hut needs at least two particles.");
+	if (velocities.size() != positions.size()) throw std::runtime_error("Barnes-Hut needs as many velocity buffers as position buffers.");
+
+	// Scene bounds, Morton codes with their particle indices and the tree, all rebuilt from scratch every step.
+	{
+		auto usage = vk::BufferUsageFlagBits::eStorageBuffer;
+
+		m_bounds = Renderer::createBufferUnique(6 * sizeof(uint32_t), usage | vk::BufferUsageFlagBits::eTransferDst, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_keys = Renderer::createBufferUnique(count * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_values = Renderer::createBufferUnique(count * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_nodes = Renderer::createBufferUnique((2 * count - 1) * sizeof(barnes_hut_node), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+
+	m_sort = std::make_unique<RadixSort>(count, RadixSort::KeyType::Uint32, m_keys->value, m_values->value, layouts, registry);
+
+	// Pipelines. Bounds through force share one layout, so their descriptor set is only bound again after the sort.
+	{
+		const std::array<const char*, PassCount> paths{ {
+			"shaders/barnes_hut_bounds.comp.spv",
+			"shaders/barnes_hut_morton.comp.spv",
+			"shaders/barnes_hut_build.comp.spv",
+			"shaders/barnes_hut_summarize.comp.spv",
+			"shaders/barnes_hut_force.comp.spv"
+		} };
+
+		std::vector<const Shader*> shaders;
+		for (auto path : paths)
+			shaders.push_back(&Shader::FetchShader(path));
+		PipelineInterface pipelineInterface = PipelineInterface::Reflect(shaders);
+		vk::PipelineLayout layout = layouts.getPipelineLayout(pipelineInterface);
+
+		// The bounds reduction halves the workgroup each round.
+		const auto& limits = vkRenderCtx.physicalDeviceProperties.limits;
+		uint32_t groupSize = powerOfTwoFloor(std::min({ 256u, limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations }));
+
+		for (uint32_t pass = 0; pass < PassCount; ++pass)
+		{
+			m_passes[pass].setShader(paths[pass]);
+			m_passes[pass].specialize("local_size_x", groupSize);
+			m_passes[pass].setLayout(layout);
+		}
+
+		m_passes[Force].specialize("TIME_STEP", params.timeStep);
+		m_passes[Force].specialize("kG", params.G);
+		m_passes[Force].specialize("SOFTENING", params.softening);
+		m_passes[Force].specialize("THETA", params.theta);
+
+		for (auto& pass : m_passes)
+			pass.create(registry);
+
+		// Descriptors
+		vk::DescriptorSetLayout setLayout = layouts.getDescriptorSetLayout(pipelineInterface.sets.at(0));
+
+		vk::DescriptorBufferInfo bounds{ m_bounds->value, 0, VK_WHOLE_SIZE };
+		vk::DescriptorBufferInfo keys{ m_keys->value, 0, VK_WHOLE_SIZE };
+		vk::DescriptorBufferInfo values{ m_values->value, 0, VK_WHOLE_SIZE };
+		vk::DescriptorBufferInfo nodes{ m_nodes->value, 0, VK_WHOLE_SIZE };
+
+		m_descriptorSets = ParticleSimulation::AllocateStepSets(m_descriptorPool, setLayout, count * sizeof(glm::vec4), positions, velocities, { bounds, keys, values, nodes });
+	}
+}
+
+void BarnesHut::record(vk::CommandBuffer cb, uint32_t in, uint32_t out)
+{
+	const vk::AccessFlags readWrite = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+	auto barrier = [&cb, readWrite]() { ComputePipeline::barrier(cb, vk::PipelineStageFlagBits::eComputeShader, readWrite); };
+
+	// The previous step may still be reading the bounds.
+	cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {});
+
+	// Empty box for the atomics to grow, min in the first three uints and max in the last three.
+	cb.fillBuffer(m_bounds->value, 0, 3 * sizeof(uint32_t), 0xFFFFFFFFu);
+	cb.fillBuffer(m_bounds->value, 3 * sizeof(uint32_t), 3 * sizeof(uint32_t), 0);
+	cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {},
+		{ vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, readWrite } }, {}, {});
+
+	Params params{ m_count };
+
+	m_passes[Bounds].bind(cb);
+	m_passes[Bounds].bindDescriptorSets(cb, 0, { m_descriptorSets[in * m_states + out] });
+	m_passes[Bounds].pushConstants(cb, 0, sizeof(params), &params);
+	m_passes[Bounds].dispatchInvocations(cb, m_count);
+	barrier();
+
+	m_passes[Morton].bind(cb);
+	m_passes[Morton].dispatchInvocations(cb, m_count);
+	barrier();
+
+	m_sort->record(cb, m_count);
+	barrier();
+
+	// The sort binds its own layout, so the descriptor set and push constants go in again.
+	m_passes[Build].bind(cb);
+	m_passes[Build].bindDescriptorSets(cb, 0, { m_descriptorSets[in * m_states + out] });
+	m_passes[Build].pushConstants(cb, 0, sizeof(params), &params);
+	m_passes[Build].dispatchInvocations(cb, m_count - 1);
+	barrier();
+
+	m_passes[Summarize].bind(cb);
+	m_passes[Summarize].dispatchInvocations(cb, m_count);
+	barrier();
+
+	m_passes[Force].bind(cb);
+	m_passes[Force].dispatchInvocations(cb, m_count);
+}
+
+std::vector<ComputePipeline*> BarnesHut::pipelines()
+{
+	std::vector<ComputePipeline*> pipelines = m_sort->pipelines();
+	for (auto& pass : m_passes)
+		pipelines.push_back(&pass);
+	return pipelines;
+}
+
+void BarnesHut::StepCpu(const ParticleState& in, ParticleState& out, ThreadPool& threadPool, const BarnesHutParams& params)
+{
+	size_t count = in.size();
+	if (count < 2) throw std::runtime_error("Barnes-Hut needs at least two particles.");
+
+	out.resize(count);
+
+	glm::vec3 lo(in.positions[0]);
+	glm::vec3 hi(in.positions[0]);
+	for (auto& position : in.positions)
+	{
+		lo = glm::min(lo, glm::vec3(position));
+		hi = glm::max(hi, glm::vec3(position));
+	}
+	glm::vec3 extent = glm::max(hi - lo, glm::vec3(1e-20f));
+
+	// Morton codes, sorted together with the particle index. Both radix sorts are stable, so ties go by index on the GPU too.
+	std::vector<uint32_t> keys(count);
+	std::vector<uint32_t> sorted(count);
+	threadPool.parallelFor(count, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			glm::uvec3 cell = glm::uvec3(glm::clamp((glm::vec3(in.positions[i]) - lo) / extent * 1024.0f, glm::vec3(0.0f), glm::vec3(1023.0f)));
+			keys[i] = expandBits(cell.x) * 4 + expandBits(cell.y) * 2 + expandBits(cell.z);
+			sorted[i] = static_cast<uint32_t>(i);
+		}
+	});
+	RadixSort::SortCpu(keys, &sorted, threadPool);
+
+	std::vector<barnes_hut_node> nodes(2 * count - 1);
+	for (size_t k = 0; k < count; ++k)
+	{
+		glm::vec4 p = in.positions[sorted[k]];
+		nodes[count - 1 + k] = barnes_hut_node{ p, glm::vec4(glm::vec3(p), 0.0f), glm::vec4(glm::vec3(p), 0.0f), -1, -1, 0, 0 };
+	}
+
+	buildTree(keys, nodes, threadPool);
+	summarize(nodes, 0);
+
+	threadPool.parallelFor(count, [&](size_t begin, size_t end)
+	{
+		for (size_t k = begin; k < end; ++k)
+		{
+			uint32_t i = sorted[k];
+			glm::vec4 pos = in.positions[i];
+			glm::vec3 acc(0.0f);
+
+			int32_t stack[stackSize];
+			int top = 0;
+			stack[top++] = 0;
+
+			while (top > 0)
+			{
+				const barnes_hut_node& node = nodes[stack[--top]];
+
+				glm::vec3 offset = glm::vec3(node.com - pos);
+				float distSquared = glm::dot(offset, offset);
+				glm::vec3 size3 = glm::vec3(node.boundsMax - node.boundsMin);
+				float size = std::max(size3.x, std::max(size3.y, size3.z));
+
+				if (node.left < 0 || size * size < params.theta * params.theta * distSquared || top + 2 > stackSize)
+				{
+					float softened = distSquared + params.softening * params.softening;
+					acc += node.com.w * offset / std::sqrt(softened * softened * softened);
+				}
+				else
+				{
+					stack[top++] = node.left;
+					stack[top++] = node.right;
+				}
+			}
+
+			glm::vec3 velocity = glm::vec3(in.velocities[i]) + params.G * acc * params.timeStep;
+			out.velocities[i] = glm::vec4(velocity, 0.0f);
+			out.positions[i] = glm::vec4(glm::vec3(pos) + velocity * params.timeStep, pos.w);
+		}
+	});
+}
@@ -0,0 +1,76 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <array>
+#include "globals.h"
+#include "pipeline.h"
+#include "particles_cpu.h"
+#include "radix_sort.h"
+#include "thread_pool.h"
+
+// Matches node in shaders/barnes_hut.glsl.
+struct barnes_hut_node
+{
+	glm::vec4 com; // Centre of mass in xyz, mass in w.
+	glm::vec4 boundsMin;
+	glm::vec4 boundsMax;
+	int32_t left; // Children are -1 for leaves.
+	int32_t right;
+	int32_t parent;
+	int32_t visits;
+};
+
+// Same defaults as the specialization constants in the shaders.
+struct BarnesHutParams : NBodyParams
+{
+	float theta = 0.5f; // Opening angle, nodes smaller than theta times their distance are taken as one mass.
+};
+
+// O(N log N) gravity on the GPU. Each step sorts the particles along a Morton curve, builds a binary radix tree
+// over the sorted codes, sums up mass and bounds bottom up and walks the tree for every particle.
+class BarnesHut
+{
+public:
+	// Steps between any two of a ring of states, a position and a velocity buffer each. At least two particles.
+	BarnesHut(uint32_t count, const std::vector<vk::Buffer>& positions, const std::vector<vk::Buffer>& velocities, PipelineLayoutCache& layouts, PipelineRegistry& registry, const BarnesHutParams& params = {});
+
+	// Records a step reading state in and writing state out, out of the states passed to the constructor.
+	void record(vk::CommandBuffer cb, uint32_t in, uint32_t out);
+
+	// Its own passes and the sort's, for shader reloads.
+	std::vector<ComputePipeline*> pipelines();
+
+	// Same step on the CPU, split over the pool's threads. Gives the result the GPU should match.
+	static void StepCpu(const ParticleState& in, ParticleState& out, ThreadPool& threadPool, const BarnesHutParams& params = {});
+
+private:
+	enum Pass
+	{
+		Bounds,
+		Morton,
+		Build,
+		Summarize,
+		Force,
+		PassCount
+	};
+
+	uint32_t m_count;
+	uint32_t m_states;
+
+	UniqueVmaAlloc<vk::Buffer> m_bounds;
+	UniqueVmaAlloc<vk::Buffer> m_keys;
+	UniqueVmaAlloc<vk::Buffer> m_values;
+	UniqueVmaAlloc<vk::Buffer> m_nodes;
+
+	std::array<ComputePipeline, PassCount> m_passes;
+	std::unique_ptr<RadixSort> m_sort; // Orders m_values by m_keys, between the Morton and build passes.
+	vk::UniqueDescriptorPool m_descriptorPool;
+	std::vector<vk::DescriptorSet> m_descriptorSets; // Set i * states + j reads state i and writes state j, sets with i == j are unused.
+};
+
+#endif
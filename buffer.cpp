@@ -76,6 +76,35 @@ void buffer::updateBuffers(const VmaAlloc<vk::Buffer>& alloc, const std::vector<
 }
 
 
+staging_arena::staging_arena(vk::DeviceSize capacity) :
+	m_buffer(Renderer::createBufferUnique(std::max<vk::DeviceSize>(capacity, 1), vk::BufferUsageFlagBits::eTransferSrc, VMA_MEMORY_USAGE_CPU_ONLY)),
+	m_capacity(capacity)
+{
+	vk::Result result{ vmaMapMemory(vkRenderCtx.allocator, m_buffer->allocation, reinterpret_cast<void**>(&m_data)) };
+	if (result != vk::Result::eSuccess)
+		vk::throwResultException(result, "vmaMapMemory");
+}
+
+staging_arena::~staging_arena()
+{
+	vmaUnmapMemory(vkRenderCtx.allocator, m_buffer->allocation);
+}
+
+vk::DeviceSize staging_arena::allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+	vk::DeviceSize head = m_head.load();
+	vk::DeviceSize offset;
+	do
+	{
+		offset = align_offset(head, alignment);
+		if (offset + size > m_capacity)
+			throw std::runtime_error("Staging arena is out of space.");
+	} while (!m_head.compare_exchange_weak(head, offset + size));
+
+	return offset;
+}
+
+
 template<typename IndexType>
 vk::DeviceSize index_buffer<IndexType>::alignment()
 {
@@ -5,6 +5,7 @@
 #define BUFFER_H
 
 
+#include <atomic>
 #include <glm/glm.hpp>
 #include <vulkan/vulkan.hpp>
 #include "globals.h"
@@ -37,6 +38,42 @@ protected:
 };
 
 
+// Persistently mapped host buffer that several threads can carve ranges out of, so many uploads can share one staging buffer and submission.
+class staging_arena
+{
+public:
+	explicit staging_arena(vk::DeviceSize capacity);
+	~staging_arena();
+
+	staging_arena(const staging_arena&) = delete;
+	staging_arena& operator=(const staging_arena&) = delete;
+
+	// Returns the offset of a new range, thread safe.
+	vk::DeviceSize allocate(vk::DeviceSize size, vk::DeviceSize alignment);
+
+	uint8_t* data(vk::DeviceSize offset)
+	{
+		return m_data + offset;
+	}
+
+	vk::Buffer buffer() const
+	{
+		return m_buffer->value;
+	}
+
+	vk::DeviceSize used() const
+	{
+		return m_head.load();
+	}
+
+private:
+	UniqueVmaAlloc<vk::Buffer> m_buffer;
+	uint8_t* m_data = nullptr;
+	vk::DeviceSize m_capacity;
+	std::atomic<vk::DeviceSize> m_head{ 0 };
+};
+
+
 template<typename Vertex>
 class vertex_buffer : public buffer
 {
@@ -0,0 +1,27 @@
+#include "stdafx.h"
+#include "fixed_timestep.h"
+
+#include <cmath>
+
+FixedTimestep::FixedTimestep(double stepSeconds, uint32_t maxStepsPerFrame) :
+	m_stepSeconds(stepSeconds),
+	m_maxStepsPerFrame(maxStepsPerFrame)
+{
+	if (stepSeconds <= 0.0) throw std::runtime_error("Fixed timestep needs a positive step length.");
+}
+
+uint32_t FixedTimestep::advance(double frameSeconds)
+{
+	m_accumulator += std::max(frameSeconds, 0.0);
+
+	double due = std::floor(m_accumulator / m_stepSeconds);
+	m_accumulator = std::max(m_accumulator - due * m_stepSeconds, 0.0);
+
+	if (due > m_maxStepsPerFrame)
+	{
+		m_droppedSteps += static_cast<uint64_t>(due) - m_maxStepsPerFrame;
+		return m_maxStepsPerFrame;
+	}
+
+	return static_cast<uint32_t>(due);
+}
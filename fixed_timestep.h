@@ -0,0 +1,40 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef FIXED_TIMESTEP_H
+#define FIXED_TIMESTEP_H
+
+#include <cstdint>
+
+// Turns variable frame times into a whole number of fixed length simulation steps, carrying the rest over to the next frame.
+class FixedTimestep
+{
+public:
+	// Runs at most maxStepsPerFrame steps per frame. Time past that is dropped, so under load the simulation slows down
+	// instead of every slow frame queueing up more steps for the next one.
+	FixedTimestep(double stepSeconds, uint32_t maxStepsPerFrame);
+
+	// Adds a frame's time and returns how many steps to run for it.
+	uint32_t advance(double frameSeconds);
+
+	// How far into the next step the time carried over reaches, from 0 to 1. Drawing the state that far between the last
+	// two steps keeps motion smooth when steps and frames don't line up.
+	float interpolation() const
+	{
+		return static_cast<float>(m_accumulator / m_stepSeconds);
+	}
+	// Steps left out to stay within maxStepsPerFrame.
+	uint64_t droppedSteps() const
+	{
+		return m_droppedSteps;
+	}
+
+private:
+	double m_stepSeconds;
+	uint32_t m_maxStepsPerFrame;
+
+	double m_accumulator = 0.0;
+	uint64_t m_droppedSteps = 0;
+};
+
+#endif
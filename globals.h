@@ -21,12 +21,18 @@ struct vkRenderCtx_t
 	uint32_t queueFamily;
 	vk::Queue queue;
 
+	// A compute only family when the device has one, so simulation overlaps rendering. Otherwise the graphics queue.
+	uint32_t computeQueueFamily;
+	vk::Queue computeQueue;
+
 	vk::Format swapchainFormat;
 	vk::Extent2D swapchainExtent;
 
 	vk::RenderPass renderPass;
 
 	vk::CommandPool commandPool;
+
+	vk::PipelineCache pipelineCache;
 };
 
 extern vkRenderCtx_t vkRenderCtx;
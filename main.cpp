@@ -5,6 +5,8 @@
 #include <vector>
 #include <fstream>
 #include <algorithm>
+#include <exception>
+#include <thread>
 
 #include <vulkan/vulkan.hpp>
 #include <glm/glm.hpp>
@@ -12,7 +14,9 @@
 #include <termcolor.hpp>
 
 #include "renderer.h"
+#include "window.h"
 #include "scene.h"
+#include "particles_cpu.h"
 
 std::ostream& operator<<(std::ostream& os, vk::DebugReportFlagsEXT flags)
 {
@@ -76,18 +80,77 @@ VkBool32 callback_fn(
 	return false;
 }
 
-int main()
+// Simulates the scene's particles on the CPU without opening a window or touching Vulkan.
+int runHeadless(uint32_t steps)
 {
-	Renderer renderer;
+	try {
+		Scene myscene = Scene::Load("../myscene.txt");
+		if (myscene.particleCount() == 0) throw std::runtime_error("Scene has no particles to simulate.");
+
+		ThreadPool threadPool;
+		ParticleSimulationCpu simulation(ParticleState::Disk(myscene.particleCount()), threadPool);
+		simulation.benchmark(steps);
+	}
+	catch (std::runtime_error e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	std::string mode = argc > 1 ? argv[1] : "";
+
+	// --headless [steps]
+	if (mode == "--headless")
+		return runHeadless(argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 10);
 
 	try {
-		renderer.init();
+		Window window(WIDTH, HEIGHT, "Vulkan Test");
+
+		Renderer renderer;
+		renderer.init(window);
 
 		Scene myscene = Scene::Load("../myscene.txt");
 		renderer.loadScene(myscene);
 
-		renderer.loop();
+		// --benchmark [steps], times the GPU particle simulation and exits.
+		if (mode == "--benchmark")
+		{
+			renderer.benchmarkParticles(argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 10);
+			return 0;
+		}
+
+		// --sort-benchmark [count], exits with 1 when the GPU and CPU radix sorts disagree.
+		if (mode == "--sort-benchmark")
+			return renderer.benchmarkSort(argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 1 << 20) ? 0 : 1;
+
+		// --validate, exits with 1 when the GPU simulation strays from the CPU reference.
+		if (mode == "--validate")
+			return renderer.validateParticles() ? 0 : 1;
+
+		// Rendering gets a thread of its own, so a slow present doesn't hold up input and input doesn't hold up frames.
+		std::exception_ptr renderError;
+		std::thread renderThread([&renderer, &window, &renderError]()
+		{
+			try {
+				renderer.loop();
+			}
+			catch (...)
+			{
+				renderError = std::current_exception();
+				window.close();
+			}
+		});
+
+		window.run(renderer.commands());
+		renderThread.join();
 
+		if (renderError)
+			std::rethrow_exception(renderError);
 	}
 	catch (std::runtime_error e)
 	{
@@ -0,0 +1,107 @@
+#include "stdafx.h"
+
+#include "mapped_file.h"
+
+#ifndef WIN32
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+MappedFile MappedFile::Open(std::string path)
+{
+#ifdef WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("File not found. Path = " + path);
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	size_t size = static_cast<size_t>(fileSize.QuadPart);
+
+	if (size == 0)
+	{
+		CloseHandle(file);
+		return { std::move(path), nullptr, 0 };
+	}
+
+	// The view keeps the mapping alive, both handles can be closed straight away.
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+	if (mapping) CloseHandle(mapping);
+	CloseHandle(file);
+
+	if (!data) throw std::runtime_error("Failed to map file. Path = " + path);
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error("File not found. Path = " + path);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("Failed to stat file. Path = " + path);
+	}
+	size_t size = static_cast<size_t>(st.st_size);
+
+	if (size == 0)
+	{
+		::close(fd);
+		return { std::move(path), nullptr, 0 };
+	}
+
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (data == MAP_FAILED) throw std::runtime_error("Failed to map file. Path = " + path);
+
+	// Files are read front to back, once, when copying into staging buffers.
+	madvise(data, size, MADV_SEQUENTIAL);
+	madvise(data, size, MADV_WILLNEED);
+#endif
+
+	return { std::move(path), static_cast<const uint8_t*>(data), size };
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+	m_path(std::move(other.m_path)),
+	m_data(other.m_data),
+	m_size(other.m_size)
+{
+	other.m_data = nullptr;
+	other.m_size = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		m_path = std::move(other.m_path);
+		m_data = other.m_data;
+		m_size = other.m_size;
+		other.m_data = nullptr;
+		other.m_size = 0;
+	}
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+void MappedFile::close()
+{
+	if (!m_data) return;
+
+#ifdef WIN32
+	UnmapViewOfFile(m_data);
+#else
+	munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+}
@@ -0,0 +1,52 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+
+// Read only memory mapping of a whole file, unmapped when destroyed.
+class MappedFile
+{
+public:
+	static MappedFile Open(std::string path);
+
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile();
+
+	const std::string& path() const
+	{
+		return m_path;
+	}
+	const uint8_t* data() const
+	{
+		return m_data;
+	}
+	size_t size() const
+	{
+		return m_size;
+	}
+
+private:
+
+	MappedFile(std::string path, const uint8_t* data, size_t size) :
+		m_path(std::move(path)),
+		m_data(data),
+		m_size(size)
+	{}
+
+	void close();
+
+	std::string m_path;
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+};
+
+#endif
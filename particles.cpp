@@ -0,0 +1,373 @@
+#include "stdafx.h"
+#include "particles.h"
+
+#include "renderer.h"
+
+namespace
+{
+	SpatialHashParams collisionParams(const NBodyParams& params)
+	{
+		SpatialHashParams collision;
+		collision.timeStep = params.timeStep;
+		return collision;
+	}
+}
+
+ParticleSimulation::ParticleSimulation(const ParticleState& particles, PipelineLayoutCache& layouts, PipelineRegistry& registry, Solver solver, const NBodyParams& params) :
+	m_count(static_cast<uint32_t>(particles.size())),
+	m_params(params)
+{
+	if (particles.size() == 0) throw std::runtime_error("Particle simulation needs at least one particle.");
+
+	vk::DeviceSize size = m_count * sizeof(glm::vec4);
+	auto usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+
+	std::vector<vk::Buffer> positions, velocities;
+	for (uint32_t i = 0; i < stateCount; ++i)
+	{
+		m_positions[i] = Renderer::createBufferUnique(size, usage, VMA_MEMORY_USAGE_GPU_ONLY, true);
+		m_velocities[i] = Renderer::createBufferUnique(size, usage, VMA_MEMORY_USAGE_GPU_ONLY, true);
+		positions.push_back(m_positions[i]->value);
+		velocities.push_back(m_velocities[i]->value);
+	}
+
+	upload(particles);
+
+	if (solver == Solver::Automatic)
+		solver = m_count >= barnesHutThreshold ? Solver::BarnesHut : Solver::BruteForce;
+
+	if (solver == Solver::BarnesHut)
+	{
+		m_barnesHut = std::make_unique<BarnesHut>(m_count, positions, velocities, layouts, registry, BarnesHutParams{ params });
+	}
+	else if (solver == Solver::Collisions)
+	{
+		m_spatialHash = std::make_unique<SpatialHash>(m_count, positions, velocities, layouts, registry, collisionParams(params));
+	}
+	else
+	{
+		initBruteForce(positions, velocities, layouts, registry);
+	}
+
+	initStepping();
+}
+
+ParticleSimulation::Solver ParticleSimulation::ParseSolver(const std::string& name)
+{
+	if (name.empty() || name == "auto")
+		return Solver::Automatic;
+	if (name == "bruteforce")
+		return Solver::BruteForce;
+	if (name == "barneshut")
+		return Solver::BarnesHut;
+	if (name == "collisions")
+		return Solver::Collisions;
+
+	throw std::runtime_error("Unknown particle solver " + name + ".");
+}
+
+std::vector<vk::DescriptorSet> ParticleSimulation::AllocateStepSets(vk::UniqueDescriptorPool& pool, vk::DescriptorSetLayout setLayout, vk::DeviceSize size,
+	const std::vector<vk::Buffer>& positions, const std::vector<vk::Buffer>& velocities, const std::vector<vk::DescriptorBufferInfo>& shared)
+{
+	uint32_t states = static_cast<uint32_t>(positions.size());
+	uint32_t setCount = states * states;
+	uint32_t bindingCount = 4 + static_cast<uint32_t>(shared.size());
+
+	vk::DescriptorPoolSize poolSize{ vk::DescriptorType::eStorageBuffer, bindingCount * setCount };
+	pool = vkRenderCtx.device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{ {}, setCount, 1, &poolSize });
+
+	std::vector<vk::DescriptorSetLayout> setLayouts(setCount, setLayout);
+	std::vector<vk::DescriptorSet> sets = vkRenderCtx.device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ *pool, setCount, setLayouts.data() });
+
+	for (uint32_t set = 0; set < setCount; ++set)
+	{
+		uint32_t i = set / states, j = set % states;
+		if (i == j)
+			continue;
+
+		std::vector<vk::DescriptorBufferInfo> bufferInfos{
+			{ positions[i], 0, size },
+			{ velocities[i], 0, size },
+			{ positions[j], 0, size },
+			{ velocities[j], 0, size }
+		};
+		bufferInfos.insert(bufferInfos.end(), shared.begin(), shared.end());
+
+		std::vector<vk::WriteDescriptorSet> writes;
+		for (uint32_t binding = 0; binding < bindingCount; ++binding)
+			writes.push_back(vk::WriteDescriptorSet{ sets[set], binding, 0, 1, vk::DescriptorType::eStorageBuffer }.setPBufferInfo(&bufferInfos[binding]));
+
+		vkRenderCtx.device.updateDescriptorSets(writes, {});
+	}
+
+	return sets;
+}
+
+void ParticleSimulation::initBruteForce(const std::vector<vk::Buffer>& positions, const std::vector<vk::Buffer>& velocities, PipelineLayoutCache& layouts, PipelineRegistry& registry)
+{
+	vk::DeviceSize size = m_count * sizeof(glm::vec4);
+
+	// Pipeline
+	{
+		const auto& limits = vkRenderCtx.physicalDeviceProperties.limits;
+		uint32_t groupSize = std::min({ workgroupSize, limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations });
+
+		m_pipeline.setShader("shaders/shader.comp.spv");
+		m_pipeline.specialize("local_size_x", groupSize);
+		m_pipeline.specialize("TIME_STEP", m_params.timeStep);
+		m_pipeline.specialize("kG", m_params.G);
+		m_pipeline.specialize("SOFTENING", m_params.softening);
+		m_pipeline.setLayout(layouts.getPipelineLayout(m_pipeline.reflectInterface()));
+		m_pipeline.create(registry);
+	}
+
+	// Descriptors
+	{
+		PipelineInterface pipelineInterface = m_pipeline.reflectInterface();
+		vk::DescriptorSetLayout setLayout = layouts.getDescriptorSetLayout(pipelineInterface.sets.at(0));
+
+		m_descriptorSets = AllocateStepSets(m_descriptorPool, setLayout, size, positions, velocities);
+	}
+}
+
+void ParticleSimulation::initStepping()
+{
+	m_computeCommandPool = vkRenderCtx.device.createCommandPoolUnique(vk::CommandPoolCreateInfo{ vk::CommandPoolCreateFlagBits::eResetCommandBuffer, vkRenderCtx.computeQueueFamily });
+	m_batchCommandBuffers = vkRenderCtx.device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{ *m_computeCommandPool, vk::CommandBufferLevel::ePrimary, 2 });
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		m_batchFinished[i] = vkRenderCtx.device.createSemaphoreUnique(vk::SemaphoreCreateInfo{});
+		m_rendered[i] = vkRenderCtx.device.createSemaphoreUnique(vk::SemaphoreCreateInfo{});
+		m_batchFences[i] = vkRenderCtx.device.createFenceUnique(vk::FenceCreateInfo{ vk::FenceCreateFlagBits::eSignaled });
+	}
+}
+
+void ParticleSimulation::submitSteps(uint32_t steps, float interpolation)
+{
+	uint32_t slot = m_batch % 2;
+
+	// The slot's command buffer may still be pending from two batches ago.
+	vkRenderCtx.device.waitForFences({ *m_batchFences[slot] }, true, std::numeric_limits<uint64_t>::max());
+	vkRenderCtx.device.resetFences({ *m_batchFences[slot] });
+
+	vk::CommandBuffer cb = m_batchCommandBuffers[slot].get();
+	cb.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+	// Consecutive batches aren't always ordered by the semaphores, and a batch reads what the one before wrote.
+	cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {},
+		{ vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite } }, {}, {});
+
+	recordSteps(cb, steps);
+
+	cb.end();
+
+	// With no steps the frame draws the same states as the last one.
+	m_drawRing[slot] = m_ring;
+	m_drawInterpolation[slot] = interpolation;
+
+	vk::SubmitInfo submitInfo{ 0, nullptr, nullptr, 1, &cb, 1, &m_batchFinished[slot].get() };
+
+	// The batch may overwrite the states the previous frame drew.
+	vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eComputeShader;
+	if (m_batch > 0)
+		submitInfo.setWaitSemaphoreCount(1).setPWaitSemaphores(&m_rendered[1 - slot].get()).setPWaitDstStageMask(&waitStage);
+
+	vkRenderCtx.computeQueue.submit({ submitInfo }, *m_batchFences[slot]);
+
+	++m_batch;
+}
+
+void ParticleSimulation::recordSteps(vk::CommandBuffer cb, uint32_t steps)
+{
+	if (steps == 0)
+		return;
+
+	// Only the two states after the latest one are written, so the last two outputs land next to each other
+	// and the pair a running frame draws stays untouched.
+	uint32_t in = (m_ring + 1) % stateCount;
+	uint32_t first = (m_ring + 2) % stateCount;
+	uint32_t second = (m_ring + 3) % stateCount;
+
+	for (uint32_t i = 0; i < steps; ++i)
+	{
+		if (i != 0)
+			ComputePipeline::barrier(cb);
+
+		uint32_t out = steps == 1 || (steps - i) % 2 == 0 ? first : second;
+		recordStep(cb, in, out);
+		in = out;
+	}
+
+	m_ring = (m_ring + std::min(steps, 2u)) % stateCount;
+}
+
+void ParticleSimulation::recordStep(vk::CommandBuffer cb, uint32_t in, uint32_t out)
+{
+	if (m_barnesHut)
+	{
+		m_barnesHut->record(cb, in, out);
+		return;
+	}
+	if (m_spatialHash)
+	{
+		m_spatialHash->record(cb, in, out);
+		return;
+	}
+
+	m_pipeline.bind(cb);
+	m_pipeline.bindDescriptorSets(cb, 0, { m_descriptorSets[in * stateCount + out] });
+	m_pipeline.pushConstants(cb, 0, sizeof(m_count), &m_count);
+	m_pipeline.dispatchInvocations(cb, m_count);
+}
+
+std::vector<ComputePipeline*> ParticleSimulation::pipelines()
+{
+	if (m_barnesHut)
+		return m_barnesHut->pipelines();
+	if (m_spatialHash)
+		return m_spatialHash->pipelines();
+	return { &m_pipeline };
+}
+
+double ParticleSimulation::benchmark(uint32_t steps)
+{
+	double seconds = Renderer::timeCommands([this, steps](vk::CommandBuffer cb) { recordSteps(cb, steps); });
+
+	if (m_barnesHut || m_spatialHash)
+	{
+		double rate = static_cast<double>(m_count) * steps / seconds;
+
+		std::cout << "N-body: " << m_count << " particles, " << steps << (m_barnesHut ? " Barnes-Hut" : " collision") << " steps in " << seconds * 1000.0 << "ms, "
+			<< rate * 1e-6 << " M particle updates/s" << std::endl;
+
+		return rate;
+	}
+
+	double interactions = static_cast<double>(m_count) * m_count * steps;
+	double rate = interactions / seconds;
+
+	// Every workgroup loads every position into its tiles, on top of each invocation's own read and write of both arrays.
+	uint32_t groups = (m_count + m_pipeline.workgroupSize()[0] - 1) / m_pipeline.workgroupSize()[0];
+	double bytes = (static_cast<double>(groups) * m_count + 4.0 * m_count) * sizeof(glm::vec4) * steps;
+
+	std::cout << "N-body: " << m_count << " particles, " << steps << " steps in " << seconds * 1000.0 << "ms, "
+		<< rate * 1e-9 << " G interactions/s, " << bytes / seconds * 1e-9 << " GB/s (workgroup " << m_pipeline.workgroupSize()[0] << ")" << std::endl;
+
+	return rate;
+}
+
+void ParticleSimulation::runSteps(uint32_t steps)
+{
+	auto cb = std::move(vkRenderCtx.device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{ vkRenderCtx.commandPool, vk::CommandBufferLevel::ePrimary, 1 }).front());
+
+	cb->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+	recordSteps(cb.get(), steps);
+	cb->end();
+
+	auto fence = vkRenderCtx.device.createFenceUnique(vk::FenceCreateInfo{});
+	vkRenderCtx.queue.submit({ vk::SubmitInfo{ 0, nullptr, nullptr, 1, &cb.get() } }, *fence);
+	vkRenderCtx.device.waitForFences({ *fence }, true, std::numeric_limits<uint64_t>::max());
+}
+
+void ParticleSimulation::upload(const ParticleState& particles)
+{
+	if (particles.size() != m_count || particles.velocities.size() != m_count) throw std::runtime_error("Particle state doesn't match the simulation's particle count.");
+
+	vkRenderCtx.queue.waitIdle();
+	vkRenderCtx.computeQueue.waitIdle();
+
+	// Both arrays go through one staging buffer, one after the other.
+	vk::DeviceSize size = m_count * sizeof(glm::vec4);
+	UniqueVmaAlloc<vk::Buffer> stagingBuffer = Renderer::createBufferUnique(2 * size, vk::BufferUsageFlagBits::eTransferSrc, VMA_MEMORY_USAGE_CPU_ONLY);
+
+	char* data;
+	vmaMapMemory(vkRenderCtx.allocator, stagingBuffer->allocation, reinterpret_cast<void**>(&data));
+	memcpy(data, particles.positions.data(), size);
+	memcpy(data + size, particles.velocities.data(), size);
+	vmaUnmapMemory(vkRenderCtx.allocator, stagingBuffer->allocation);
+
+	// Into every state, frames before the first batch draw the uploaded state as both the latest one and the one before.
+	for (uint32_t i = 0; i < stateCount; ++i)
+	{
+		Renderer::copyBuffer(*stagingBuffer, *m_positions[i], { vk::BufferCopy{ 0, 0, size } });
+		Renderer::copyBuffer(*stagingBuffer, *m_velocities[i], { vk::BufferCopy{ size, 0, size } });
+	}
+}
+
+ParticleState ParticleSimulation::readState() const
+{
+	vkRenderCtx.queue.waitIdle();
+	vkRenderCtx.computeQueue.waitIdle();
+
+	vk::DeviceSize size = m_count * sizeof(glm::vec4);
+	UniqueVmaAlloc<vk::Buffer> stagingBuffer = Renderer::createBufferUnique(2 * size, vk::BufferUsageFlagBits::eTransferDst, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+	uint32_t latest = (m_ring + 1) % stateCount;
+	Renderer::copyBuffer(*m_positions[latest], *stagingBuffer, { vk::BufferCopy{ 0, 0, size } });
+	Renderer::copyBuffer(*m_velocities[latest], *stagingBuffer, { vk::BufferCopy{ 0, size, size } });
+
+	ParticleState particles;
+	particles.resize(m_count);
+
+	char* data;
+	vmaMapMemory(vkRenderCtx.allocator, stagingBuffer->allocation, reinterpret_cast<void**>(&data));
+	memcpy(particles.positions.data(), data, size);
+	memcpy(particles.velocities.data(), data + size, size);
+	vmaUnmapMemory(vkRenderCtx.allocator, stagingBuffer->allocation);
+
+	return particles;
+}
+
+float ParticleSimulation::validationTolerance(const ParticleState& particles) const
+{
+	float totalMass = 0.0f;
+	float extent = 0.0f;
+	for (size_t i = 0; i < particles.size(); ++i)
+	{
+		totalMass += particles.positions[i].w;
+		extent = std::max(extent, glm::length(glm::vec3(particles.positions[i])));
+	}
+
+	// No pull is stronger than all the mass at the softening length, or for collisions a full cell of overlap.
+	SpatialHashParams collision = collisionParams(m_params);
+	float maxAcceleration = m_spatialHash ? collision.stiffness * collision.cellSize : m_params.G * totalMass / (m_params.softening * m_params.softening);
+
+	// Summing in another order changes the acceleration by a small part of that, and the step moves positions by it times the
+	// time step squared. Barnes-Hut may also open different nodes when the tree bounds round differently.
+	float relative = m_barnesHut ? 1e-3f : 1e-4f;
+	return relative * maxAcceleration * m_params.timeStep * m_params.timeStep + 1e-6f * extent;
+}
+
+bool ParticleSimulation::validate(ThreadPool& threadPool)
+{
+	ParticleState before = readState();
+	runSteps(1);
+	ParticleState gpu = readState();
+
+	ParticleState cpu;
+	if (m_barnesHut)
+		BarnesHut::StepCpu(before, cpu, threadPool, BarnesHutParams{ m_params });
+	else if (m_spatialHash)
+		SpatialHash::StepCpu(before, cpu, threadPool, collisionParams(m_params));
+	else
+		ParticleSimulationCpu::Step(before, cpu, threadPool, m_params);
+
+	float maxError = 0.0f;
+	for (size_t i = 0; i < gpu.size(); ++i)
+	{
+		maxError = std::max(maxError, glm::length(glm::vec3(gpu.positions[i] - cpu.positions[i])));
+	}
+
+	float tolerance = validationTolerance(before);
+	const char* solver = m_barnesHut ? "Barnes-Hut" : m_spatialHash ? "collision" : "brute force";
+
+	if (maxError > tolerance)
+	{
+		std::cerr << "N-body: " << solver << " GPU step differs from the CPU reference by " << maxError << ", more than the tolerance of " << tolerance << std::endl;
+		return false;
+	}
+
+	std::cout << "N-body: " << solver << " GPU step differs from the CPU reference by at most " << maxError << ", tolerance " << tolerance << std::endl;
+	return true;
+}
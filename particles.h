@@ -0,0 +1,154 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include "globals.h"
+#include "pipeline.h"
+#include "barnes_hut.h"
+#include "spatial_hash.h"
+#include "particles_cpu.h"
+#include "thread_pool.h"
+
+// GPU N-body simulation. Each step reads one state buffer out of a ring of stateCount and writes another.
+// Per frame, submitSteps() runs that frame's steps on the compute queue while the frame draws what the previous frame's steps left.
+// Frames draw straight from the ring: the latest state and the one before it sit at consecutive positions, and a batch
+// only writes the other two while a frame draws them.
+class ParticleSimulation
+{
+public:
+	static constexpr uint32_t stateCount = 4;
+
+	enum class Solver
+	{
+		Automatic, // Barnes-Hut from barnesHutThreshold particles on, brute force below.
+		BruteForce,
+		BarnesHut,
+		Collisions // Short range contact forces through a spatial hash instead of gravity, never picked automatically.
+	};
+
+	// From the names scene files use: auto, bruteforce, barneshut or collisions. Empty is auto.
+	static Solver ParseSolver(const std::string& name);
+
+	// Allocates a descriptor set per pair of states, set i * states + j reads state i and writes state j. Bindings 0 to 3 hold
+	// the positions and velocities in and out and the buffers in shared follow from binding 4 on. Sets with i == j stay empty.
+	static std::vector<vk::DescriptorSet> AllocateStepSets(vk::UniqueDescriptorPool& pool, vk::DescriptorSetLayout setLayout, vk::DeviceSize size,
+		const std::vector<vk::Buffer>& positions, const std::vector<vk::Buffer>& velocities, const std::vector<vk::DescriptorBufferInfo>& shared = {});
+
+	ParticleSimulation(const ParticleState& particles, PipelineLayoutCache& layouts, PipelineRegistry& registry, Solver solver = Solver::Automatic, const NBodyParams& params = {});
+
+	// Records steps one after the other, later commands reading the new state need their own barrier.
+	void recordSteps(vk::CommandBuffer cb, uint32_t steps);
+
+	// Every pass of the solver, for shader reloads. Batches pick up rebuilt pipelines as they are recorded.
+	std::vector<ComputePipeline*> pipelines();
+
+	// Submits a batch of steps on the compute queue, once per frame before the frame's graphics submit, even when steps is 0.
+	// That submit has to wait on renderWaitSemaphore() and signal renderSignalSemaphore().
+	// Interpolation is how far past the last of the steps the frames drawing their result are, in steps.
+	void submitSteps(uint32_t steps, float interpolation);
+	// Signalled by the batch that wrote the states the current frame draws, null when they hold the initial state.
+	vk::Semaphore renderWaitSemaphore() const
+	{
+		return m_batch >= 2 ? *m_batchFinished[m_batch % 2] : vk::Semaphore();
+	}
+	// Lets the batch after next overwrite the states the current frame draws.
+	vk::Semaphore renderSignalSemaphore() const
+	{
+		return *m_rendered[(m_batch + 1) % 2];
+	}
+	// Ring position of the states the current frame draws, written by the batch before the one running alongside it.
+	uint32_t renderSlot() const
+	{
+		return m_drawRing[m_batch % 2];
+	}
+	// For mixing from drawPreviousPositionBuffer() to drawPositionBuffer() of the current frame's slot.
+	float renderInterpolation() const
+	{
+		return m_drawInterpolation[m_batch % 2];
+	}
+
+	// Runs steps on their own on the queue and reports the throughput, in interactions per second for brute force
+	// and particle updates per second for the other solvers.
+	double benchmark(uint32_t steps);
+
+	// Replaces the latest state, waits for the queues to be idle first.
+	void upload(const ParticleState& particles);
+	// Copies the latest state back, waits for the queues to be idle first.
+	ParticleState readState() const;
+	// Runs one step on the GPU and on the CPU from the same state and checks the largest position difference against
+	// validationTolerance(), printing both. Returns whether it is within.
+	bool validate(ThreadPool& threadPool);
+	// How far a GPU step may move a particle away from the CPU reference, for the state given.
+	float validationTolerance(const ParticleState& particles) const;
+
+	uint32_t count() const
+	{
+		return m_count;
+	}
+	bool usesBarnesHut() const
+	{
+		return m_barnesHut != nullptr;
+	}
+	bool usesSpatialHash() const
+	{
+		return m_spatialHash != nullptr;
+	}
+	// What a frame draws at a ring position: the positions before and after the last step of a batch and the velocities after it.
+	// Usable as vertex buffers with a vec4 per particle.
+	vk::Buffer drawPreviousPositionBuffer(uint32_t slot) const
+	{
+		return m_positions[slot]->value;
+	}
+	vk::Buffer drawPositionBuffer(uint32_t slot) const
+	{
+		return m_positions[(slot + 1) % stateCount]->value;
+	}
+	vk::Buffer drawVelocityBuffer(uint32_t slot) const
+	{
+		return m_velocities[(slot + 1) % stateCount]->value;
+	}
+
+private:
+	static constexpr uint32_t workgroupSize = 256;
+	static constexpr uint32_t barnesHutThreshold = 1 << 18;
+
+	void initBruteForce(const std::vector<vk::Buffer>& positions, const std::vector<vk::Buffer>& velocities, PipelineLayoutCache& layouts, PipelineRegistry& registry);
+	void initStepping();
+
+	void recordStep(vk::CommandBuffer cb, uint32_t in, uint32_t out);
+
+	// Records and submits steps on their own, waiting for them to finish.
+	void runSteps(uint32_t steps);
+
+	uint32_t m_count;
+	uint32_t m_ring = 0; // The latest state is at m_ring + 1, the one before it at m_ring.
+	NBodyParams m_params;
+
+	UniqueVmaAlloc<vk::Buffer> m_positions[stateCount];
+	UniqueVmaAlloc<vk::Buffer> m_velocities[stateCount];
+
+	// Indexed by the batch parity.
+	uint32_t m_drawRing[2] = {};
+	float m_drawInterpolation[2] = {};
+
+	// Used instead of the brute force pipeline when set.
+	std::unique_ptr<BarnesHut> m_barnesHut;
+	std::unique_ptr<SpatialHash> m_spatialHash;
+
+	ComputePipeline m_pipeline;
+	vk::UniqueDescriptorPool m_descriptorPool;
+	std::vector<vk::DescriptorSet> m_descriptorSets; // Set i * stateCount + j reads state i and writes state j.
+
+	vk::UniqueCommandPool m_computeCommandPool;
+	std::vector<vk::UniqueCommandBuffer> m_batchCommandBuffers; // Recorded again for every batch, indexed by the batch parity.
+	vk::UniqueSemaphore m_batchFinished[2]; // Indexed by the batch parity.
+	vk::UniqueSemaphore m_rendered[2];
+	vk::UniqueFence m_batchFences[2];
+	uint64_t m_batch = 0; // Batches submitted with submitSteps().
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "stdafx.h"
+#include "particles_cpu.h"
+
+#include <random>
+
+#if defined(__AVX__)
+#	include <immintrin.h>
+#	define PARTICLES_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define PARTICLES_SSE
+#endif
+
+namespace
+{
+#if defined(PARTICLES_AVX)
+	const size_t laneWidth = 8;
+#elif defined(PARTICLES_SSE)
+	const size_t laneWidth = 4;
+#else
+	const size_t laneWidth = 1;
+#endif
+
+	// Acceleration on the particle at p from every particle in the lanes, before scaling by G.
+	glm::vec3 accelerate(const float* x, const float* y, const float* z, const float* mass, size_t paddedCount, glm::vec3 p, float softening2)
+	{
+#if defined(PARTICLES_AVX)
+		__m256 px = _mm256_set1_ps(p.x), py = _mm256_set1_ps(p.y), pz = _mm256_set1_ps(p.z);
+		__m256 soft = _mm256_set1_ps(softening2), one = _mm256_set1_ps(1.0f);
+		__m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps(), az = _mm256_setzero_ps();
+
+		for (size_t j = 0; j < paddedCount; j += laneWidth)
+		{
+			__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + j), px);
+			__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + j), py);
+			__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + j), pz);
+
+			__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_add_ps(_mm256_mul_ps(dz, dz), soft));
+			// A full precision divide rather than rsqrt, so the results stay close to the GPU's.
+			__m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(d2));
+			__m256 s = _mm256_mul_ps(_mm256_loadu_ps(mass + j), _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+
+			ax = _mm256_add_ps(ax, _mm256_mul_ps(s, dx));
+			ay = _mm256_add_ps(ay, _mm256_mul_ps(s, dy));
+			az = _mm256_add_ps(az, _mm256_mul_ps(s, dz));
+		}
+
+		alignas(32) float sums[3][8];
+		_mm256_store_ps(sums[0], ax);
+		_mm256_store_ps(sums[1], ay);
+		_mm256_store_ps(sums[2], az);
+#elif defined(PARTICLES_SSE)
+		__m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+		__m128 soft = _mm_set1_ps(softening2), one = _mm_set1_ps(1.0f);
+		__m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps(), az = _mm_setzero_ps();
+
+		for (size_t j = 0; j < paddedCount; j += laneWidth)
+		{
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + j), px);
+			__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + j), py);
+			__m128 dz = _mm_sub_ps(_mm_loadu_ps(z + j), pz);
+
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_add_ps(_mm_mul_ps(dz, dz), soft));
+			__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(d2));
+			__m128 s = _mm_mul_ps(_mm_loadu_ps(mass + j), _mm_mul_ps(inv, _mm_mul_ps(inv, inv)));
+
+			ax = _mm_add_ps(ax, _mm_mul_ps(s, dx));
+			ay = _mm_add_ps(ay, _mm_mul_ps(s, dy));
+			az = _mm_add_ps(az, _mm_mul_ps(s, dz));
+		}
+
+		alignas(16) float sums[3][4];
+		_mm_store_ps(sums[0], ax);
+		_mm_store_ps(sums[1], ay);
+		_mm_store_ps(sums[2], az);
+#else
+		float sums[3][1] = {};
+
+		for (size_t j = 0; j < paddedCount; ++j)
+		{
+			glm::vec3 offset = glm::vec3(x[j], y[j], z[j]) - p;
+			float d2 = glm::dot(offset, offset) + softening2;
+			float inv = 1.0f / std::sqrt(d2);
+			float s = mass[j] * inv * inv * inv;
+
+			sums[0][0] += s * offset.x;
+			sums[1][0] += s * offset.y;
+			sums[2][0] += s * offset.z;
+		}
+#endif
+
+		glm::vec3 acc(0.0f);
+		for (size_t lane = 0; lane < laneWidth; ++lane)
+			acc += glm::vec3(sums[0][lane], sums[1][lane], sums[2][lane]);
+		return acc;
+	}
+}
+
+ParticleState ParticleState::Disk(size_t count, uint32_t seed)
+{
+	// kG in shader.comp, with unit masses each particle pulls with this strength.
+	const float G = 0.005f;
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	ParticleState particles;
+	particles.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		// Uniform over the disk's area, so the mass inside radius r grows with r squared.
+		float r = 0.05f + 0.95f * std::sqrt(unit(rng));
+		float angle = 2.0f * glm::pi<float>() * unit(rng);
+
+		glm::vec3 dir{ std::cos(angle), std::sin(angle), 0.0f };
+		float enclosed = static_cast<float>(count) * r * r;
+		float speed = std::sqrt(G * enclosed / r);
+
+		particles.positions[i] = glm::vec4(dir * r, 1.0f);
+		particles.velocities[i] = glm::vec4(-dir.y, dir.x, 0.0f, 0.0f) * speed;
+	}
+
+	return particles;
+}
+
+void ParticleSimulationCpu::Lanes::resize(size_t count)
+{
+	size_t padded = (count + laneWidth - 1) / laneWidth * laneWidth;
+
+	// Zero filled, so the padding has no mass.
+	for (auto lane : { &x, &y, &z, &mass, &vx, &vy, &vz })
+		lane->assign(padded, 0.0f);
+}
+
+ParticleSimulationCpu::ParticleSimulationCpu(const ParticleState& particles, ThreadPool& threadPool, const NBodyParams& params) :
+	m_count(static_cast<uint32_t>(particles.size())),
+	m_threadPool(threadPool),
+	m_params(params)
+{
+	if (particles.size() == 0) throw std::runtime_error("Particle simulation needs at least one particle.");
+
+	for (auto& lanes : m_lanes)
+		lanes.resize(m_count);
+
+	Lanes& lanes = m_lanes[0];
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		lanes.x[i] = particles.positions[i].x;
+		lanes.y[i] = particles.positions[i].y;
+		lanes.z[i] = particles.positions[i].z;
+		lanes.mass[i] = particles.positions[i].w;
+		lanes.vx[i] = particles.velocities[i].x;
+		lanes.vy[i] = particles.velocities[i].y;
+		lanes.vz[i] = particles.velocities[i].z;
+	}
+}
+
+void ParticleSimulationCpu::Step(const ParticleState& in, ParticleState& out, ThreadPool& threadPool, const NBodyParams& params)
+{
+	ParticleSimulationCpu simulation(in, threadPool, params);
+	simulation.step();
+	out = simulation.state();
+}
+
+const char* ParticleSimulationCpu::InstructionSet()
+{
+#if defined(PARTICLES_AVX)
+	return "AVX";
+#elif defined(PARTICLES_SSE)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+void ParticleSimulationCpu::StepLanes(const Lanes& in, Lanes& out, uint32_t count, ThreadPool& threadPool, const NBodyParams& params)
+{
+	size_t paddedCount = in.x.size();
+	float softening2 = params.softening * params.softening;
+
+	threadPool.parallelFor(count, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			glm::vec3 p(in.x[i], in.y[i], in.z[i]);
+			glm::vec3 acc = accelerate(in.x.data(), in.y.data(), in.z.data(), in.mass.data(), paddedCount, p, softening2);
+
+			glm::vec3 velocity = glm::vec3(in.vx[i], in.vy[i], in.vz[i]) + params.G * acc * params.timeStep;
+			glm::vec3 position = p + velocity * params.timeStep;
+
+			out.x[i] = position.x;
+			out.y[i] = position.y;
+			out.z[i] = position.z;
+			out.mass[i] = in.mass[i];
+			out.vx[i] = velocity.x;
+			out.vy[i] = velocity.y;
+			out.vz[i] = velocity.z;
+		}
+	});
+}
+
+void ParticleSimulationCpu::step(uint32_t steps)
+{
+	for (uint32_t i = 0; i < steps; ++i)
+	{
+		StepLanes(m_lanes[m_current], m_lanes[1 - m_current], m_count, m_threadPool, m_params);
+		m_current = 1 - m_current;
+	}
+}
+
+double ParticleSimulationCpu::benchmark(uint32_t steps)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	step(steps);
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	double interactions = static_cast<double>(m_count) * m_count * steps;
+	double rate = interactions / seconds;
+
+	std::cout << "N-body (CPU): " << m_count << " particles, " << steps << " steps in " << seconds * 1000.0 << "ms, "
+		<< rate * 1e-9 << " G interactions/s (" << InstructionSet() << ", " << m_threadPool.size() << " threads)" << std::endl;
+
+	return rate;
+}
+
+ParticleState ParticleSimulationCpu::state() const
+{
+	const Lanes& lanes = m_lanes[m_current];
+
+	ParticleState particles;
+	particles.resize(m_count);
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		particles.positions[i] = glm::vec4(lanes.x[i], lanes.y[i], lanes.z[i], lanes.mass[i]);
+		particles.velocities[i] = glm::vec4(lanes.vx[i], lanes.vy[i], lanes.vz[i], 0.0f);
+	}
+
+	return particles;
+}
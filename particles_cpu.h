@@ -0,0 +1,82 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef PARTICLES_CPU_H
+#define PARTICLES_CPU_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "thread_pool.h"
+
+// Host copy of the simulation state, laid out like the GPU buffers: a std430 vec4 array per attribute.
+// Kernels that only need positions, like the N-body tile loads, fetch half the bytes an interleaved layout would.
+struct ParticleState
+{
+	std::vector<glm::vec4> positions; // Mass in w.
+	std::vector<glm::vec4> velocities; // w is unused.
+
+	size_t size() const
+	{
+		return positions.size();
+	}
+	void resize(size_t count)
+	{
+		positions.resize(count);
+		velocities.resize(count);
+	}
+
+	// Particles of unit mass orbiting in a flat disk around the origin.
+	static ParticleState Disk(size_t count, uint32_t seed = 1);
+};
+
+// Same defaults as the specialization constants in shaders/shader.comp.
+struct NBodyParams
+{
+	float timeStep = 0.001f;
+	float G = 0.005f;
+	float softening = 0.01f;
+};
+
+// The brute force step of shaders/shader.comp on the CPU, SIMD over the particles pulling and threads over the ones pulled.
+// Checks GPU results and runs the simulation where there is no Vulkan device.
+class ParticleSimulationCpu
+{
+public:
+	ParticleSimulationCpu(const ParticleState& particles, ThreadPool& threadPool, const NBodyParams& params = {});
+
+	// One step from in to out, for comparing against a GPU step from the same state.
+	static void Step(const ParticleState& in, ParticleState& out, ThreadPool& threadPool, const NBodyParams& params = {});
+	// AVX, SSE2 or scalar, as compiled.
+	static const char* InstructionSet();
+
+	void step(uint32_t steps = 1);
+	// Runs steps and reports the throughput in interactions per second.
+	double benchmark(uint32_t steps);
+
+	ParticleState state() const;
+	uint32_t count() const
+	{
+		return m_count;
+	}
+
+private:
+	// Structure of arrays with the length padded to the SIMD width, the padding is massless and pulls on nothing.
+	struct Lanes
+	{
+		std::vector<float> x, y, z, mass;
+		std::vector<float> vx, vy, vz;
+
+		void resize(size_t count);
+	};
+
+	static void StepLanes(const Lanes& in, Lanes& out, uint32_t count, ThreadPool& threadPool, const NBodyParams& params);
+
+	uint32_t m_count;
+	uint32_t m_current = 0;
+	Lanes m_lanes[2];
+
+	ThreadPool& m_threadPool;
+	NBodyParams m_params;
+};
+
+#endif
@@ -3,14 +3,70 @@
 #include "renderer.h"
 #include "shader.h"
 
+#include <cstring>
+
+void CompleteGraphicsPipelineCreateInfo::link()
+{
+	m_specializations.resize(m_shaderStages.size());
+	for (size_t i = 0; i < m_shaderStages.size(); ++i)
+		m_shaderStages[i].pSpecializationInfo = m_specializations[i].info();
+
+	m_pipelineCreateInfo.stageCount = static_cast<uint32_t>(m_shaderStages.size());
+	m_pipelineCreateInfo.pStages = m_shaderStages.data();
+}
+
+template<typename T>
+static const T* rebase(const T* pointer, const T* from, const T* to)
+{
+	return pointer == from ? to : pointer;
+}
+
+void CompleteGraphicsPipelineCreateInfo::relink(const CompleteGraphicsPipelineCreateInfo& from)
+{
+	auto& info = m_pipelineCreateInfo;
+	info.pVertexInputState = rebase(info.pVertexInputState, &from.m_vertexInputState, &m_vertexInputState);
+	info.pInputAssemblyState = rebase(info.pInputAssemblyState, &from.m_inputAssemblyState, &m_inputAssemblyState);
+	info.pTessellationState = rebase(info.pTessellationState, &from.m_tessellationState, &m_tessellationState);
+	info.pViewportState = rebase(info.pViewportState, &from.m_viewportState, &m_viewportState);
+	info.pRasterizationState = rebase(info.pRasterizationState, &from.m_rasterizationState, &m_rasterizationState);
+	info.pMultisampleState = rebase(info.pMultisampleState, &from.m_multisampleState, &m_multisampleState);
+	info.pDepthStencilState = rebase(info.pDepthStencilState, &from.m_depthStencilState, &m_depthStencilState);
+	info.pColorBlendState = rebase(info.pColorBlendState, &from.m_colorBlendState, &m_colorBlendState);
+	info.pDynamicState = rebase(info.pDynamicState, &from.m_dynamicState, &m_dynamicState);
+
+	m_vertexInputState.pVertexBindingDescriptions = rebase(m_vertexInputState.pVertexBindingDescriptions, from.m_vertexBindings.data(), m_vertexBindings.data());
+	m_vertexInputState.pVertexAttributeDescriptions = rebase(m_vertexInputState.pVertexAttributeDescriptions, from.m_vertexAttributes.data(), m_vertexAttributes.data());
+	m_viewportState.pViewports = rebase(m_viewportState.pViewports, &from.m_viewport, &m_viewport);
+	m_viewportState.pScissors = rebase(m_viewportState.pScissors, &from.m_scissor, &m_scissor);
+
+	// Stage pointers are set again by link().
+	info.stageCount = 0;
+	info.pStages = nullptr;
+}
+
 void Pipeline::create(bool keepCreateInfo)
 {
 	if (!m_createInfo) throw std::runtime_error("Pipeline info was never initialized before create() call.");
 
-	m_createInfo->m_pipelineCreateInfo.stageCount = static_cast<uint32_t>(m_createInfo->m_shaderStages.size());
-	m_createInfo->m_pipelineCreateInfo.pStages = m_createInfo->m_shaderStages.data();
+	m_createInfo->link();
 
-	m_pipeline = vkRenderCtx.device.createGraphicsPipelineUnique(nullptr, m_createInfo->m_pipelineCreateInfo);
+	m_pipeline = vkRenderCtx.device.createGraphicsPipelineUnique(vkRenderCtx.pipelineCache, m_createInfo->m_pipelineCreateInfo);
+	m_handle = *m_pipeline;
+	m_pending = {};
+
+	if (!keepCreateInfo)
+		m_createInfo.reset();
+}
+
+void Pipeline::create(PipelineRegistry& registry, bool keepCreateInfo)
+{
+	if (!m_createInfo) throw std::runtime_error("Pipeline info was never initialized before create() call.");
+
+	m_createInfo->link();
+
+	m_pipeline.reset();
+	m_handle = nullptr;
+	m_pending = registry.request(*m_createInfo);
 
 	if (!keepCreateInfo)
 		m_createInfo.reset();
@@ -23,6 +79,59 @@ void Pipeline::addShaderStage(const std::string& shaderPath)
 	const Shader& shader = Shader::FetchShader(shaderPath);
 	
 	m_createInfo->m_shaderStages.push_back(shader.getStageInfo());
+	m_createInfo->m_specializations.emplace_back();
+	m_shaders.push_back(&shader);
+}
+
+Pipeline Pipeline::variant() const
+{
+	if (!m_createInfo) throw std::runtime_error("Pipeline can't make a variant without its create info.");
+
+	Pipeline copy;
+	copy.m_createInfo = std::make_unique<CompleteGraphicsPipelineCreateInfo>(*m_createInfo);
+	copy.m_createInfo->relink(*m_createInfo);
+	copy.m_shaders = m_shaders;
+	return copy;
+}
+
+size_t Pipeline::stageIndex(vk::ShaderStageFlagBits stage) const
+{
+	if (m_createInfo)
+	{
+		for (size_t i = 0; i < m_createInfo->m_shaderStages.size(); ++i)
+		{
+			if (m_createInfo->m_shaderStages[i].stage == stage)
+				return i;
+		}
+	}
+	throw std::runtime_error("Pipeline has no " + vk::to_string(stage) + " stage.");
+}
+
+Pipeline& Pipeline::setSpecialization(vk::ShaderStageFlagBits stage, SpecializationConstants constants)
+{
+	specialization(stage) = std::move(constants);
+	return *this;
+}
+
+SpecializationConstants& Pipeline::specialization(vk::ShaderStageFlagBits stage)
+{
+	size_t i = stageIndex(stage);
+	m_createInfo->m_specializations.resize(m_createInfo->m_shaderStages.size());
+	return m_createInfo->m_specializations[i];
+}
+
+uint32_t Pipeline::specializationId(vk::ShaderStageFlagBits stage, const std::string& name) const
+{
+	const Shader& shader = *m_shaders[stageIndex(stage)];
+	auto constant = shader.reflection().findSpecializationConstant(name);
+	if (!constant) throw std::runtime_error("Shader has no specialization constant " + name + ". Path = " + shader.path());
+
+	return constant->id;
+}
+
+PipelineInterface Pipeline::reflectInterface() const
+{
+	return PipelineInterface::Reflect(m_shaders);
 }
 
 vk::PipelineVertexInputStateCreateInfo& Pipeline::getVertexInputState()
@@ -101,6 +210,32 @@ Pipeline& Pipeline::setBasePipeline(vk::Pipeline basePipelineHandle)
 	return *this;
 }
 
+Pipeline& Pipeline::setVertexInput(std::vector<vk::VertexInputBindingDescription> bindings, std::vector<vk::VertexInputAttributeDescription> attributes)
+{
+	if (!m_createInfo) m_createInfo = std::make_unique<CompleteGraphicsPipelineCreateInfo>();
+	m_createInfo->m_vertexBindings = std::move(bindings);
+	m_createInfo->m_vertexAttributes = std::move(attributes);
+	m_createInfo->m_vertexInputState
+		.setVertexBindingDescriptionCount(static_cast<uint32_t>(m_createInfo->m_vertexBindings.size()))
+		.setPVertexBindingDescriptions(m_createInfo->m_vertexBindings.data())
+		.setVertexAttributeDescriptionCount(static_cast<uint32_t>(m_createInfo->m_vertexAttributes.size()))
+		.setPVertexAttributeDescriptions(m_createInfo->m_vertexAttributes.data());
+	return *this;
+}
+
+Pipeline& Pipeline::setViewport(vk::Viewport viewport, vk::Rect2D scissor)
+{
+	if (!m_createInfo) m_createInfo = std::make_unique<CompleteGraphicsPipelineCreateInfo>();
+	m_createInfo->m_viewport = viewport;
+	m_createInfo->m_scissor = scissor;
+	m_createInfo->m_viewportState
+		.setViewportCount(1)
+		.setPViewports(&m_createInfo->m_viewport)
+		.setScissorCount(1)
+		.setPScissors(&m_createInfo->m_scissor);
+	return *this;
+}
+
 Pipeline& Pipeline::setBasePipeline(int32_t basePipelineIndex)
 {
 	if (!m_createInfo) m_createInfo = std::make_unique<CompleteGraphicsPipelineCreateInfo>();
@@ -108,7 +243,712 @@ Pipeline& Pipeline::setBasePipeline(int32_t basePipelineIndex)
 	return *this;
 }
 
+vk::Pipeline Pipeline::handle()
+{
+	if (m_pending.valid())
+	{
+		m_handle = m_pending.get();
+		m_pending = {};
+	}
+	return m_handle;
+}
+
 void Pipeline::bind(vk::CommandBuffer cb)
 {
-	cb.bindPipeline(vk::PipelineBindPoint::eGraphics, *m_pipeline);
+	cb.bindPipeline(vk::PipelineBindPoint::eGraphics, handle());
+}
+
+bool Pipeline::usesShader(const Shader& shader) const
+{
+	return std::find(m_shaders.begin(), m_shaders.end(), &shader) != m_shaders.end();
+}
+
+void Pipeline::rebuild(PipelineRegistry& registry)
+{
+	if (!m_createInfo) throw std::runtime_error("Pipeline can't be rebuilt without its create info.");
+	if (m_pipeline) throw std::runtime_error("Only pipelines created through a registry can be rebuilt.");
+
+	// Shaders reload in place, the stages pick up their new modules.
+	for (size_t i = 0; i < m_shaders.size(); ++i)
+		m_createInfo->m_shaderStages[i] = m_shaders[i]->getStageInfo();
+	m_createInfo->link();
+
+	std::string key = PipelineRegistry::key(*m_createInfo);
+	std::shared_future<vk::Pipeline> superseded = std::move(m_rebuild);
+	bool sameKey = key == m_rebuildKey;
+
+	m_rebuild = registry.request(*m_createInfo);
+	m_rebuildKey = std::move(key);
+
+	// An identical request shares the superseded compile, anything else would leave its pipeline unused in the registry.
+	if (!superseded.valid() || sameKey)
+		return;
+
+	superseded.wait();
+	try {
+		vk::Pipeline pipeline = superseded.get();
+		if (pipeline != handle())
+			registry.release(pipeline);
+	}
+	catch (std::runtime_error e)
+	{
+		// A failed compile left nothing behind.
+	}
+}
+
+bool Pipeline::rebuildReady() const
+{
+	return m_rebuild.valid() && m_rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+vk::Pipeline Pipeline::finishRebuild()
+{
+	std::shared_future<vk::Pipeline> rebuild = std::move(m_rebuild);
+	m_rebuild = {};
+	m_rebuildKey.clear();
+
+	vk::Pipeline rebuilt = rebuild.get();
+	vk::Pipeline old = handle();
+	m_handle = rebuilt;
+	return old;
 }
+
+#pragma region PipelineRegistry
+
+namespace
+{
+	struct KeyWriter
+	{
+		std::string bytes;
+
+		template<typename T>
+		void add(const T& value)
+		{
+			bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		// Only for element types without padding or pointers, they are appended as raw bytes.
+		template<typename T>
+		void addArray(const T* values, uint32_t count)
+		{
+			add(count);
+			if (values && count)
+				bytes.append(reinterpret_cast<const char*>(values), sizeof(T) * count);
+		}
+
+		// Non dispatchable handles are pointers or 64 bit integers depending on the platform.
+		template<typename CHandle>
+		void addHandle(CHandle handle)
+		{
+			uint64_t value = 0;
+			std::memcpy(&value, &handle, sizeof(CHandle));
+			add(value);
+		}
+
+		void addString(const char* str)
+		{
+			bytes.append(str ? str : "");
+			bytes.push_back('\0');
+		}
+
+		// Extension structs aren't followed, a pNext chain only matches the exact same chain.
+		void addNext(const void* pNext)
+		{
+			add(reinterpret_cast<uintptr_t>(pNext));
+		}
+	};
+}
+
+std::string PipelineRegistry::key(const CompleteGraphicsPipelineCreateInfo& createInfo)
+{
+	const vk::GraphicsPipelineCreateInfo& info = createInfo.m_pipelineCreateInfo;
+	KeyWriter key;
+
+	key.add(vk::PipelineBindPoint::eGraphics);
+	key.addNext(info.pNext);
+	key.add(static_cast<VkPipelineCreateFlags>(info.flags));
+
+	key.add(info.stageCount);
+	for (uint32_t i = 0; i < info.stageCount; ++i)
+	{
+		const vk::PipelineShaderStageCreateInfo& stage = info.pStages[i];
+		key.addNext(stage.pNext);
+		key.add(stage.stage);
+		key.addHandle(static_cast<VkShaderModule>(stage.module));
+		key.addString(stage.pName);
+
+		key.add(stage.pSpecializationInfo != nullptr);
+		if (stage.pSpecializationInfo)
+		{
+			key.addArray(stage.pSpecializationInfo->pMapEntries, stage.pSpecializationInfo->mapEntryCount);
+			key.addArray(static_cast<const uint8_t*>(stage.pSpecializationInfo->pData), static_cast<uint32_t>(stage.pSpecializationInfo->dataSize));
+		}
+	}
+
+	key.add(info.pVertexInputState != nullptr);
+	if (auto state = info.pVertexInputState)
+	{
+		key.addNext(state->pNext);
+		key.addArray(state->pVertexBindingDescriptions, state->vertexBindingDescriptionCount);
+		key.addArray(state->pVertexAttributeDescriptions, state->vertexAttributeDescriptionCount);
+	}
+
+	key.add(info.pInputAssemblyState != nullptr);
+	if (auto state = info.pInputAssemblyState)
+	{
+		key.addNext(state->pNext);
+		key.add(state->topology);
+		key.add(state->primitiveRestartEnable);
+	}
+
+	key.add(info.pTessellationState != nullptr);
+	if (auto state = info.pTessellationState)
+	{
+		key.addNext(state->pNext);
+		key.add(state->patchControlPoints);
+	}
+
+	key.add(info.pViewportState != nullptr);
+	if (auto state = info.pViewportState)
+	{
+		key.addNext(state->pNext);
+		key.add(state->viewportCount);
+		key.addArray(state->pViewports, state->pViewports ? state->viewportCount : 0);
+		key.add(state->scissorCount);
+		key.addArray(state->pScissors, state->pScissors ? state->scissorCount : 0);
+	}
+
+	key.add(info.pRasterizationState != nullptr);
+	if (auto state = info.pRasterizationState)
+	{
+		key.addNext(state->pNext);
+		key.add(state->depthClampEnable);
+		key.add(state->rasterizerDiscardEnable);
+		key.add(state->polygonMode);
+		key.add(static_cast<VkCullModeFlags>(state->cullMode));
+		key.add(state->frontFace);
+		key.add(state->depthBiasEnable);
+		key.add(state->depthBiasConstantFactor);
+		key.add(state->depthBiasClamp);
+		key.add(state->depthBiasSlopeFactor);
+		key.add(state->lineWidth);
+	}
+
+	key.add(info.pMultisampleState != nullptr);
+	if (auto state = info.pMultisampleState)
+	{
+		key.addNext(state->pNext);
+		key.add(state->rasterizationSamples);
+		key.add(state->sampleShadingEnable);
+		key.add(state->minSampleShading);
+		key.addArray(state->pSampleMask, state->pSampleMask ? (static_cast<uint32_t>(state->rasterizationSamples) + 31) / 32 : 0);
+		key.add(state->alphaToCoverageEnable);
+		key.add(state->alphaToOneEnable);
+	}
+
+	key.add(info.pDepthStencilState != nullptr);
+	if (auto state = info.pDepthStencilState)
+	{
+		key.addNext(state->pNext);
+		key.add(state->depthTestEnable);
+		key.add(state->depthWriteEnable);
+		key.add(state->depthCompareOp);
+		key.add(state->depthBoundsTestEnable);
+		key.add(state->stencilTestEnable);
+		key.add(state->front);
+		key.add(state->back);
+		key.add(state->minDepthBounds);
+		key.add(state->maxDepthBounds);
+	}
+
+	key.add(info.pColorBlendState != nullptr);
+	if (auto state = info.pColorBlendState)
+	{
+		key.addNext(state->pNext);
+		key.add(state->logicOpEnable);
+		key.add(state->logicOp);
+		key.addArray(state->pAttachments, state->attachmentCount);
+		key.add(state->blendConstants);
+	}
+
+	key.add(info.pDynamicState != nullptr);
+	if (auto state = info.pDynamicState)
+	{
+		key.addNext(state->pNext);
+		key.addArray(state->pDynamicStates, state->dynamicStateCount);
+	}
+
+	key.addHandle(static_cast<VkPipelineLayout>(info.layout));
+	key.addHandle(static_cast<VkRenderPass>(info.renderPass));
+	key.add(info.subpass);
+	key.addHandle(static_cast<VkPipeline>(info.basePipelineHandle));
+	key.add(info.basePipelineIndex);
+
+	return std::move(key.bytes);
+}
+
+std::string PipelineRegistry::key(const Shader& shader, SpecializationConstants specialization, vk::PipelineLayout layout)
+{
+	vk::PipelineShaderStageCreateInfo stage = shader.getStageInfo(specialization.info());
+	KeyWriter key;
+
+	// Keeps compute keys apart from graphics ones.
+	key.add(vk::PipelineBindPoint::eCompute);
+	key.addHandle(static_cast<VkShaderModule>(stage.module));
+	key.addString(stage.pName);
+
+	key.add(stage.pSpecializationInfo != nullptr);
+	if (stage.pSpecializationInfo)
+	{
+		key.addArray(stage.pSpecializationInfo->pMapEntries, stage.pSpecializationInfo->mapEntryCount);
+		key.addArray(static_cast<const uint8_t*>(stage.pSpecializationInfo->pData), static_cast<uint32_t>(stage.pSpecializationInfo->dataSize));
+	}
+
+	key.addHandle(static_cast<VkPipelineLayout>(layout));
+
+	return std::move(key.bytes);
+}
+
+std::shared_future<vk::Pipeline> PipelineRegistry::request(const CompleteGraphicsPipelineCreateInfo& createInfo)
+{
+	// The caller may change its create info for a rebuild while this one is still compiling.
+	auto copy = std::make_shared<CompleteGraphicsPipelineCreateInfo>(createInfo);
+	copy->relink(createInfo);
+	copy->link();
+
+	return request(key(createInfo), [copy]()
+	{
+		return vkRenderCtx.device.createGraphicsPipeline(vkRenderCtx.pipelineCache, copy->m_pipelineCreateInfo);
+	});
+}
+
+std::shared_future<vk::Pipeline> PipelineRegistry::request(const Shader& shader, const SpecializationConstants& specialization, vk::PipelineLayout layout)
+{
+	// The stage is taken now, a reload may swap the shader's module before the compile starts.
+	auto constants = std::make_shared<SpecializationConstants>(specialization);
+	vk::PipelineShaderStageCreateInfo stage = shader.getStageInfo(constants->info());
+
+	return request(key(shader, specialization, layout), [constants, stage, layout]()
+	{
+		return vkRenderCtx.device.createComputePipeline(vkRenderCtx.pipelineCache, vk::ComputePipelineCreateInfo{ {}, stage, layout });
+	});
+}
+
+std::shared_future<vk::Pipeline> PipelineRegistry::request(std::string pipelineKey, std::function<vk::Pipeline()> compile)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_pipelines.find(pipelineKey);
+	if (it != m_pipelines.end())
+	{
+		++m_hits;
+		return it->second;
+	}
+
+	std::shared_future<vk::Pipeline> pipeline = m_threadPool.submit(std::move(compile)).share();
+
+	m_pipelines.emplace(std::move(pipelineKey), pipeline);
+	return pipeline;
+}
+
+void PipelineRegistry::release(vk::Pipeline pipeline)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto it = m_pipelines.begin(); it != m_pipelines.end(); ++it)
+	{
+		if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			continue;
+
+		try {
+			if (it->second.get() != pipeline)
+				continue;
+		}
+		catch (std::runtime_error e)
+		{
+			continue;
+		}
+
+		vkRenderCtx.device.destroyPipeline(pipeline);
+		m_pipelines.erase(it);
+		return;
+	}
+}
+
+void PipelineRegistry::wait()
+{
+	std::vector<std::shared_future<vk::Pipeline>> pipelines;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto& entry : m_pipelines)
+			pipelines.push_back(entry.second);
+	}
+
+	for (auto& pipeline : pipelines)
+		pipeline.wait();
+
+	for (auto& pipeline : pipelines)
+		pipeline.get();
+}
+
+void PipelineRegistry::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& entry : m_pipelines)
+	{
+		entry.second.wait();
+		try {
+			vkRenderCtx.device.destroyPipeline(entry.second.get());
+		}
+		catch (std::runtime_error e)
+		{
+			// Failed compiles have nothing to destroy, the error was reported to whoever waited on them.
+		}
+	}
+
+	m_pipelines.clear();
+	m_hits = 0;
+}
+
+PipelineRegistry::~PipelineRegistry()
+{
+	clear();
+}
+
+#pragma endregion
+
+#pragma region PipelineLayoutCache
+
+PipelineInterface PipelineInterface::Reflect(const std::vector<const Shader*>& shaders)
+{
+	PipelineInterface pipelineInterface;
+
+	for (const Shader* shader : shaders)
+	{
+		const ShaderReflection& reflection = shader->reflection();
+		vk::ShaderStageFlagBits stage = shader->getStageInfo().stage;
+
+		for (auto& resource : reflection.bindings())
+		{
+			if (pipelineInterface.sets.size() <= resource.set)
+				pipelineInterface.sets.resize(resource.set + 1);
+
+			auto& bindings = pipelineInterface.sets[resource.set].bindings;
+			auto it = std::find_if(bindings.begin(), bindings.end(), [&resource](const vk::DescriptorSetLayoutBinding& b) { return b.binding == resource.binding; });
+
+			if (it == bindings.end())
+			{
+				bindings.push_back(vk::DescriptorSetLayoutBinding{ resource.binding, resource.type, resource.count, stage });
+				continue;
+			}
+
+			if (it->descriptorType != resource.type)
+				throw std::runtime_error("Stages disagree on the type of set " + std::to_string(resource.set) + " binding " + std::to_string(resource.binding) + ". Path = " + shader->path());
+
+			it->stageFlags |= stage;
+			it->descriptorCount = std::max(it->descriptorCount, resource.count);
+		}
+
+		// Stages sharing the same block share a range, Vulkan doesn't allow a stage in two ranges.
+		// Shaders of the same stage, as in a layout shared by several compute passes, grow their range to cover every block.
+		for (auto& block : reflection.pushConstants())
+		{
+			auto& ranges = pipelineInterface.pushConstants;
+			auto it = std::find_if(ranges.begin(), ranges.end(), [stage](const vk::PushConstantRange& r) { return r.stageFlags == stage; });
+
+			if (it != ranges.end())
+			{
+				uint32_t end = std::max(it->offset + it->size, block.offset + block.size);
+				it->offset = std::min(it->offset, block.offset);
+				it->size = end - it->offset;
+				continue;
+			}
+
+			it = std::find_if(ranges.begin(), ranges.end(), [&block](const vk::PushConstantRange& r) { return r.offset == block.offset && r.size == block.size; });
+
+			if (it != ranges.end())
+				it->stageFlags |= stage;
+			else
+				ranges.push_back(vk::PushConstantRange{ stage, block.offset, block.size });
+		}
+	}
+
+	for (auto& set : pipelineInterface.sets)
+	{
+		std::sort(set.bindings.begin(), set.bindings.end(), [](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+	}
+
+	return pipelineInterface;
+}
+
+vk::DescriptorSetLayout PipelineLayoutCache::getDescriptorSetLayout(const DescriptorSetInterface& set)
+{
+	if (!set.bindingFlags.empty() && set.bindingFlags.size() != set.bindings.size())
+		throw std::runtime_error("Descriptor binding flags must be given for every binding or none.");
+
+	KeyWriter key;
+	key.add(static_cast<VkDescriptorSetLayoutCreateFlags>(set.flags));
+	key.add(static_cast<uint32_t>(set.bindings.size()));
+	for (size_t i = 0; i < set.bindings.size(); ++i)
+	{
+		auto& binding = set.bindings[i];
+		key.add(binding.binding);
+		key.add(binding.descriptorType);
+		key.add(binding.descriptorCount);
+		key.add(static_cast<VkShaderStageFlags>(binding.stageFlags));
+		key.addArray(binding.pImmutableSamplers, binding.pImmutableSamplers ? binding.descriptorCount : 0);
+		key.add(static_cast<VkDescriptorBindingFlagsEXT>(set.bindingFlags.empty() ? vk::DescriptorBindingFlagsEXT{} : set.bindingFlags[i]));
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_descriptorSetLayouts.find(key.bytes);
+	if (it != m_descriptorSetLayouts.end())
+		return it->second;
+
+	vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo{ static_cast<uint32_t>(set.bindingFlags.size()), set.bindingFlags.data() };
+
+	vk::DescriptorSetLayout layout = vkRenderCtx.device.createDescriptorSetLayout(
+		vk::DescriptorSetLayoutCreateInfo{
+			set.flags,
+			static_cast<uint32_t>(set.bindings.size()),
+			set.bindings.data()
+		}.setPNext(set.bindingFlags.empty() ? nullptr : &bindingFlagsInfo)
+	);
+
+	m_descriptorSetLayouts.emplace(std::move(key.bytes), layout);
+	return layout;
+}
+
+std::vector<vk::DescriptorSetLayout> PipelineLayoutCache::getDescriptorSetLayouts(const PipelineInterface& pipelineInterface)
+{
+	std::vector<vk::DescriptorSetLayout> layouts;
+	for (auto& set : pipelineInterface.sets)
+		layouts.push_back(getDescriptorSetLayout(set));
+	return layouts;
+}
+
+vk::PipelineLayout PipelineLayoutCache::getPipelineLayout(const PipelineInterface& pipelineInterface)
+{
+	std::vector<vk::DescriptorSetLayout> setLayouts = getDescriptorSetLayouts(pipelineInterface);
+
+	KeyWriter key;
+	key.add(static_cast<uint32_t>(setLayouts.size()));
+	for (auto setLayout : setLayouts)
+		key.addHandle(static_cast<VkDescriptorSetLayout>(setLayout));
+	key.addArray(pipelineInterface.pushConstants.data(), static_cast<uint32_t>(pipelineInterface.pushConstants.size()));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_pipelineLayouts.find(key.bytes);
+	if (it != m_pipelineLayouts.end())
+		return it->second;
+
+	vk::PipelineLayout layout = vkRenderCtx.device.createPipelineLayout(vk::PipelineLayoutCreateInfo{
+		{},
+		static_cast<uint32_t>(setLayouts.size()),
+		setLayouts.data(),
+		static_cast<uint32_t>(pipelineInterface.pushConstants.size()),
+		pipelineInterface.pushConstants.data()
+	});
+
+	m_pipelineLayouts.emplace(std::move(key.bytes), layout);
+	return layout;
+}
+
+void PipelineLayoutCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& entry : m_pipelineLayouts)
+		vkRenderCtx.device.destroyPipelineLayout(entry.second);
+	for (auto& entry : m_descriptorSetLayouts)
+		vkRenderCtx.device.destroyDescriptorSetLayout(entry.second);
+
+	m_pipelineLayouts.clear();
+	m_descriptorSetLayouts.clear();
+}
+
+PipelineLayoutCache::~PipelineLayoutCache()
+{
+	clear();
+}
+
+#pragma endregion
+
+#pragma region ComputePipeline
+
+ComputePipeline& ComputePipeline::setShader(const std::string& shaderPath)
+{
+	const Shader& shader = Shader::FetchShader(shaderPath);
+	if (shader.getStageInfo().stage != vk::ShaderStageFlagBits::eCompute) throw std::runtime_error("Not a compute shader. Path = " + shaderPath);
+
+	m_shader = &shader;
+	return *this;
+}
+
+PipelineInterface ComputePipeline::reflectInterface() const
+{
+	return PipelineInterface::Reflect({ m_shader });
+}
+
+ComputePipeline& ComputePipeline::setLayout(vk::PipelineLayout layout)
+{
+	m_layout = layout;
+	return *this;
+}
+
+ComputePipeline& ComputePipeline::setSpecialization(SpecializationConstants constants)
+{
+	m_specialization = std::move(constants);
+	return *this;
+}
+
+uint32_t ComputePipeline::specializationId(const std::string& name) const
+{
+	if (!m_shader) throw std::runtime_error("Compute pipeline has no shader to specialize.");
+
+	auto constant = m_shader->reflection().findSpecializationConstant(name);
+	if (!constant) throw std::runtime_error("Shader has no specialization constant " + name + ". Path = " + m_shader->path());
+
+	return constant->id;
+}
+
+void ComputePipeline::create()
+{
+	if (!m_shader) throw std::runtime_error("Compute pipeline has no shader set before create() call.");
+
+	m_pipeline = vkRenderCtx.device.createComputePipelineUnique(vkRenderCtx.pipelineCache, vk::ComputePipelineCreateInfo{
+		{},
+		m_shader->getStageInfo(m_specialization.info()),
+		m_layout
+	});
+	m_handle = *m_pipeline;
+	m_pending = {};
+
+	updateWorkgroupSize();
+}
+
+void ComputePipeline::create(PipelineRegistry& registry)
+{
+	if (!m_shader) throw std::runtime_error("Compute pipeline has no shader set before create() call.");
+
+	m_pipeline.reset();
+	m_handle = nullptr;
+	m_pending = registry.request(*m_shader, m_specialization, m_layout);
+
+	updateWorkgroupSize();
+}
+
+void ComputePipeline::updateWorkgroupSize()
+{
+	// The declared size, unless the shader takes it from specialization constants that were set.
+	m_workgroupSize = m_shader->reflection().localSize();
+	static const char* axes[] = { "local_size_x", "local_size_y", "local_size_z" };
+	for (size_t i = 0; i < 3; ++i)
+	{
+		auto constant = m_shader->reflection().findSpecializationConstant(axes[i]);
+		const void* value = constant ? m_specialization.value(constant->id) : nullptr;
+		if (value)
+			std::memcpy(&m_workgroupSize[i], value, sizeof(uint32_t));
+		m_workgroupSize[i] = std::max(m_workgroupSize[i], 1u);
+	}
+}
+
+vk::Pipeline ComputePipeline::handle()
+{
+	if (m_pending.valid())
+	{
+		m_handle = m_pending.get();
+		m_pending = {};
+	}
+	return m_handle;
+}
+
+void ComputePipeline::bind(vk::CommandBuffer cb)
+{
+	cb.bindPipeline(vk::PipelineBindPoint::eCompute, handle());
+}
+
+void ComputePipeline::rebuild(PipelineRegistry& registry)
+{
+	if (!m_shader) throw std::runtime_error("Compute pipeline has no shader to rebuild from.");
+	if (m_pipeline) throw std::runtime_error("Only pipelines created through a registry can be rebuilt.");
+
+	std::string key = PipelineRegistry::key(*m_shader, m_specialization, m_layout);
+	std::shared_future<vk::Pipeline> superseded = std::move(m_rebuild);
+	bool sameKey = key == m_rebuildKey;
+
+	m_rebuild = registry.request(*m_shader, m_specialization, m_layout);
+	m_rebuildKey = std::move(key);
+
+	if (!superseded.valid() || sameKey)
+		return;
+
+	superseded.wait();
+	try {
+		vk::Pipeline pipeline = superseded.get();
+		if (pipeline != handle())
+			registry.release(pipeline);
+	}
+	catch (std::runtime_error e)
+	{
+		// A failed compile left nothing behind.
+	}
+}
+
+bool ComputePipeline::rebuildReady() const
+{
+	return m_rebuild.valid() && m_rebuild.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+vk::Pipeline ComputePipeline::finishRebuild()
+{
+	std::shared_future<vk::Pipeline> rebuild = std::move(m_rebuild);
+	m_rebuild = {};
+	m_rebuildKey.clear();
+
+	vk::Pipeline rebuilt = rebuild.get();
+	vk::Pipeline old = handle();
+	m_handle = rebuilt;
+
+	// A reloaded shader may declare another size.
+	updateWorkgroupSize();
+	return old;
+}
+
+void ComputePipeline::bindDescriptorSets(vk::CommandBuffer cb, uint32_t firstSet, vk::ArrayProxy<const vk::DescriptorSet> sets, vk::ArrayProxy<const uint32_t> dynamicOffsets) const
+{
+	cb.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, firstSet, sets, dynamicOffsets);
+}
+
+void ComputePipeline::pushConstants(vk::CommandBuffer cb, uint32_t offset, uint32_t size, const void* values) const
+{
+	cb.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, offset, size, values);
+}
+
+void ComputePipeline::dispatch(vk::CommandBuffer cb, uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ) const
+{
+	cb.dispatch(groupsX, groupsY, groupsZ);
+}
+
+void ComputePipeline::dispatchInvocations(vk::CommandBuffer cb, uint32_t x, uint32_t y, uint32_t z) const
+{
+	cb.dispatch(
+		(x + m_workgroupSize[0] - 1) / m_workgroupSize[0],
+		(y + m_workgroupSize[1] - 1) / m_workgroupSize[1],
+		(z + m_workgroupSize[2] - 1) / m_workgroupSize[2]
+	);
+}
+
+void ComputePipeline::barrier(vk::CommandBuffer cb, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+{
+	cb.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader, dstStage, {},
+		{ vk::MemoryBarrier{ vk::AccessFlagBits::eShaderWrite, dstAccess } },
+		{}, {}
+	);
+}
+
+#pragma endregion
@@ -5,7 +5,15 @@
 #define PIPELINE_H
 
 #include <vulkan/vulkan.hpp>
+#include <array>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
+#include "shader.h"
+#include "thread_pool.h"
 
 
 struct CompleteGraphicsPipelineCreateInfo
@@ -27,6 +35,7 @@ struct CompleteGraphicsPipelineCreateInfo
 	}
 
 	std::vector<vk::PipelineShaderStageCreateInfo> m_shaderStages;
+	std::vector<SpecializationConstants> m_specializations; // One per shader stage.
 	vk::PipelineVertexInputStateCreateInfo m_vertexInputState;
 	vk::PipelineInputAssemblyStateCreateInfo m_inputAssemblyState;
 	vk::PipelineTessellationStateCreateInfo m_tessellationState;
@@ -37,6 +46,17 @@ struct CompleteGraphicsPipelineCreateInfo
 	vk::PipelineColorBlendStateCreateInfo m_colorBlendState;
 	vk::PipelineDynamicStateCreateInfo m_dynamicState;
 
+	// Storage for the arrays the states point at, when the pipeline owns them.
+	std::vector<vk::VertexInputBindingDescription> m_vertexBindings;
+	std::vector<vk::VertexInputAttributeDescription> m_vertexAttributes;
+	vk::Viewport m_viewport;
+	vk::Rect2D m_scissor;
+
+	// Points the stages at their specialization info and the create info at the stages, right before it is used.
+	void link();
+	// After a copy: moves pointers into the original's members over to this one's.
+	void relink(const CompleteGraphicsPipelineCreateInfo& from);
+
 	vk::GraphicsPipelineCreateInfo m_pipelineCreateInfo{ {},
 		0, nullptr, // Filled out later
 		&m_vertexInputState,
@@ -52,6 +72,90 @@ struct CompleteGraphicsPipelineCreateInfo
 	};
 };
 
+// Deduplicates graphics and compute pipelines by the full contents of their create info and compiles new ones on a worker pool.
+// Compiles work from a copy of the create info, only the arrays it points to outside of itself must stay alive until wait() returns.
+class PipelineRegistry
+{
+public:
+	explicit PipelineRegistry(ThreadPool& threadPool) : m_threadPool(threadPool) {}
+	~PipelineRegistry();
+
+	PipelineRegistry(const PipelineRegistry&) = delete;
+	PipelineRegistry& operator=(const PipelineRegistry&) = delete;
+
+	std::shared_future<vk::Pipeline> request(const CompleteGraphicsPipelineCreateInfo& createInfo);
+	std::shared_future<vk::Pipeline> request(const Shader& shader, const SpecializationConstants& specialization, vk::PipelineLayout layout);
+	// Destroys a pipeline and forgets its key. Nothing may still use it.
+	void release(vk::Pipeline pipeline);
+
+	// Blocks until every queued compile is done, rethrowing the first failure.
+	void wait();
+	void clear();
+
+	size_t size() const
+	{
+		return m_pipelines.size();
+	}
+	size_t hits() const
+	{
+		return m_hits;
+	}
+
+	// Bytes of every state the pipeline is built from, with handles by value and arrays followed through their pointers.
+	static std::string key(const CompleteGraphicsPipelineCreateInfo& createInfo);
+	// The shader's current module and entry point, the specialization constants with their values and the layout.
+	static std::string key(const Shader& shader, SpecializationConstants specialization, vk::PipelineLayout layout);
+
+private:
+	std::shared_future<vk::Pipeline> request(std::string pipelineKey, std::function<vk::Pipeline()> compile);
+
+	ThreadPool& m_threadPool;
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, std::shared_future<vk::Pipeline>> m_pipelines;
+	size_t m_hits = 0;
+};
+
+// Resources of one descriptor set merged across all stages that use it.
+struct DescriptorSetInterface
+{
+	vk::DescriptorSetLayoutCreateFlags flags;
+	std::vector<vk::DescriptorSetLayoutBinding> bindings;
+	std::vector<vk::DescriptorBindingFlagsEXT> bindingFlags; // Empty, or one per binding.
+};
+
+// What a group of shader stages expects from its pipeline layout, as found by reflecting their SPIR-V.
+// Runtime sized arrays come out with a descriptor count of 0 and have to be sized before building the layout.
+struct PipelineInterface
+{
+	std::vector<DescriptorSetInterface> sets; // Indexed by set number.
+	std::vector<vk::PushConstantRange> pushConstants;
+
+	static PipelineInterface Reflect(const std::vector<const Shader*>& shaders);
+};
+
+// Owns descriptor set and pipeline layouts, handing out the same object for identical interfaces.
+class PipelineLayoutCache
+{
+public:
+	PipelineLayoutCache() = default;
+	~PipelineLayoutCache();
+
+	PipelineLayoutCache(const PipelineLayoutCache&) = delete;
+	PipelineLayoutCache& operator=(const PipelineLayoutCache&) = delete;
+
+	vk::DescriptorSetLayout getDescriptorSetLayout(const DescriptorSetInterface& set);
+	std::vector<vk::DescriptorSetLayout> getDescriptorSetLayouts(const PipelineInterface& pipelineInterface);
+	vk::PipelineLayout getPipelineLayout(const PipelineInterface& pipelineInterface);
+
+	void clear();
+
+private:
+	std::mutex m_mutex;
+	std::unordered_map<std::string, vk::DescriptorSetLayout> m_descriptorSetLayouts;
+	std::unordered_map<std::string, vk::PipelineLayout> m_pipelineLayouts;
+};
+
 class Pipeline
 {
 public:
@@ -68,8 +172,23 @@ public:
 	}
 
 	void create(bool keepCreateInfo = false);
+	// Shares an identical pipeline if one was requested before, otherwise compiles on the registry's workers.
+	void create(PipelineRegistry& registry, bool keepCreateInfo = false);
 
 	void addShaderStage(const std::string& shaderPath);
+	PipelineInterface reflectInterface() const;
+
+	// A copy of everything needed to create this pipeline but not the pipeline itself, to be changed and created as a variant.
+	// Variants with the same values resolve to the same pipeline when created through a registry.
+	Pipeline variant() const;
+	Pipeline& setSpecialization(vk::ShaderStageFlagBits stage, SpecializationConstants constants);
+	// Sets a constant by its name in the stage's SPIR-V.
+	template<typename T>
+	Pipeline& specialize(vk::ShaderStageFlagBits stage, const std::string& name, T value)
+	{
+		specialization(stage).set(specializationId(stage, name), value);
+		return *this;
+	}
 	vk::PipelineVertexInputStateCreateInfo& getVertexInputState();
 	vk::PipelineInputAssemblyStateCreateInfo& getInputAssemblyState();
 	vk::PipelineTessellationStateCreateInfo& getTessellationState();
@@ -79,6 +198,9 @@ public:
 	vk::PipelineDepthStencilStateCreateInfo& getDepthStencilState();
 	vk::PipelineColorBlendStateCreateInfo& getColorBlendState();
 	vk::PipelineDynamicStateCreateInfo& getDynamicState();
+	// Copies the descriptions into the pipeline, so the create info stays valid for rebuilds.
+	Pipeline& setVertexInput(std::vector<vk::VertexInputBindingDescription> bindings, std::vector<vk::VertexInputAttributeDescription> attributes);
+	Pipeline& setViewport(vk::Viewport viewport, vk::Rect2D scissor);
 	Pipeline& setLayout(vk::PipelineLayout layout);
 	Pipeline& setRenderPass(vk::RenderPass renderPass, uint32_t subpass);
 	Pipeline& setBasePipeline(vk::Pipeline basePipelineHandle);
@@ -89,12 +211,121 @@ public:
 #pragma region Runtime Stuff
 
 	void bind(vk::CommandBuffer cb);
+	vk::Pipeline handle();
+
+	bool usesShader(const Shader& shader) const;
+
+	// Compiles a replacement from the current shaders while the old pipeline stays in use.
+	// Needs a pipeline created through a registry with its create info kept. A rebuild still pending is waited for and its pipeline released.
+	void rebuild(PipelineRegistry& registry);
+	bool rebuilding() const
+	{
+		return m_rebuild.valid();
+	}
+	bool rebuildReady() const;
+	// Switches to the rebuilt pipeline and returns the replaced one, to be released once no command buffer uses it.
+	vk::Pipeline finishRebuild();
 
 #pragma endregion
 
 private:
+	size_t stageIndex(vk::ShaderStageFlagBits stage) const;
+	SpecializationConstants& specialization(vk::ShaderStageFlagBits stage);
+	uint32_t specializationId(vk::ShaderStageFlagBits stage, const std::string& name) const;
+
 	vk::UniquePipeline m_pipeline;
+	vk::Pipeline m_handle; // Owned by m_pipeline, or by a registry.
+	std::shared_future<vk::Pipeline> m_pending;
+	std::shared_future<vk::Pipeline> m_rebuild;
+	std::string m_rebuildKey;
+	std::vector<const Shader*> m_shaders;
 	std::unique_ptr<CompleteGraphicsPipelineCreateInfo> m_createInfo;
 };
 
+class ComputePipeline
+{
+public:
+
+#pragma region Creation Stuff
+
+	ComputePipeline() = default;
+	ComputePipeline(ComputePipeline&& other) = default;
+	ComputePipeline(const ComputePipeline& other) = delete;
+
+	ComputePipeline& setShader(const std::string& shaderPath);
+	PipelineInterface reflectInterface() const;
+	ComputePipeline& setLayout(vk::PipelineLayout layout);
+	ComputePipeline& setSpecialization(SpecializationConstants constants);
+	// Sets a constant by its name in the shader's SPIR-V, local_size_x/y/z for a specializable workgroup size.
+	template<typename T>
+	ComputePipeline& specialize(const std::string& name, T value)
+	{
+		m_specialization.set(specializationId(name), value);
+		return *this;
+	}
+
+	void create();
+	// Shares an identical pipeline if one was requested before, otherwise compiles on the registry's workers.
+	void create(PipelineRegistry& registry);
+
+#pragma endregion
+
+#pragma region Runtime Stuff
+
+	void bind(vk::CommandBuffer cb);
+	void bindDescriptorSets(vk::CommandBuffer cb, uint32_t firstSet, vk::ArrayProxy<const vk::DescriptorSet> sets, vk::ArrayProxy<const uint32_t> dynamicOffsets = nullptr) const;
+	void pushConstants(vk::CommandBuffer cb, uint32_t offset, uint32_t size, const void* values) const;
+
+	// Dispatches a number of workgroups.
+	void dispatch(vk::CommandBuffer cb, uint32_t groupsX, uint32_t groupsY = 1, uint32_t groupsZ = 1) const;
+	// Dispatches enough workgroups to cover a number of invocations, the shader has to skip the ones past the end.
+	void dispatchInvocations(vk::CommandBuffer cb, uint32_t x, uint32_t y = 1, uint32_t z = 1) const;
+
+	// Makes compute shader writes visible to the commands recorded after it.
+	static void barrier(vk::CommandBuffer cb, vk::PipelineStageFlags dstStage = vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlags dstAccess = vk::AccessFlagBits::eShaderRead);
+
+	vk::Pipeline handle();
+	vk::PipelineLayout layout() const
+	{
+		return m_layout;
+	}
+	// As compiled, with specialized sizes applied.
+	const std::array<uint32_t, 3>& workgroupSize() const
+	{
+		return m_workgroupSize;
+	}
+
+	bool usesShader(const Shader& shader) const
+	{
+		return m_shader == &shader;
+	}
+
+	// Compiles a replacement from the current shader while the old pipeline stays in use, like Pipeline::rebuild().
+	// Needs a pipeline created through a registry.
+	void rebuild(PipelineRegistry& registry);
+	bool rebuilding() const
+	{
+		return m_rebuild.valid();
+	}
+	bool rebuildReady() const;
+	// Switches to the rebuilt pipeline and returns the replaced one, to be released once no command buffer uses it.
+	vk::Pipeline finishRebuild();
+
+#pragma endregion
+
+private:
+	uint32_t specializationId(const std::string& name) const;
+	void updateWorkgroupSize();
+
+	const Shader* m_shader = nullptr;
+	SpecializationConstants m_specialization;
+	vk::PipelineLayout m_layout;
+	vk::UniquePipeline m_pipeline;
+	vk::Pipeline m_handle; // Owned by m_pipeline, or by a registry.
+	std::shared_future<vk::Pipeline> m_pending;
+	std::shared_future<vk::Pipeline> m_rebuild;
+	std::string m_rebuildKey;
+	std::array<uint32_t, 3> m_workgroupSize{ { 1, 1, 1 } };
+};
+
 #endif
\ No newline at end of file
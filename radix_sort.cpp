@@ -0,0 +1,290 @@
+#include "stdafx.h"
+#include "radix_sort.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include "renderer.h"
+
+namespace
+{
+	// Matches Params in shaders/radix_sort.glsl.
+	struct Params
+	{
+		uint32_t count;
+		uint32_t groupCount;
+		uint32_t shift;
+	};
+
+	// Least significant byte first. Every chunk of keys gets its own counts per digit, scanned digit major so that each chunk
+	// scatters behind the same digits of the chunks before it, which keeps equal keys in order.
+	template<typename Key>
+	void radixSortCpu(std::vector<Key>& keys, std::vector<uint32_t>* values, ThreadPool& threadPool)
+	{
+		const uint32_t bits = 8;
+		const size_t radix = size_t(1) << bits;
+		const size_t minChunkSize = 1 << 14;
+
+		size_t count = keys.size();
+		if (values && values->size() != count) throw std::runtime_error("Radix sort needs a value for every key.");
+
+		size_t chunkCount = std::max<size_t>(1, std::min(threadPool.size(), count / minChunkSize));
+		size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+		std::vector<Key> keysOut(count);
+		std::vector<uint32_t> valuesOut(values ? count : 0);
+		std::vector<size_t> offsets(chunkCount * radix);
+
+		for (uint32_t shift = 0; shift < sizeof(Key) * 8; shift += bits)
+		{
+			threadPool.parallelFor(chunkCount, [&](size_t begin, size_t end)
+			{
+				for (size_t chunk = begin; chunk < end; ++chunk)
+				{
+					size_t* counts = &offsets[chunk * radix];
+					std::fill(counts, counts + radix, 0);
+					for (size_t i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); ++i)
+						++counts[(keys[i] >> shift) & (radix - 1)];
+				}
+			});
+
+			// Nothing moves when every key has the same digit.
+			bool sorted = false;
+			size_t start = 0;
+			for (size_t digit = 0; digit < radix; ++digit)
+			{
+				for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+				{
+					size_t n = offsets[chunk * radix + digit];
+					sorted = sorted || n == count;
+					offsets[chunk * radix + digit] = start;
+					start += n;
+				}
+			}
+			if (sorted)
+				continue;
+
+			threadPool.parallelFor(chunkCount, [&](size_t begin, size_t end)
+			{
+				for (size_t chunk = begin; chunk < end; ++chunk)
+				{
+					size_t* next = &offsets[chunk * radix];
+					for (size_t i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); ++i)
+					{
+						size_t dst = next[(keys[i] >> shift) & (radix - 1)]++;
+						keysOut[dst] = keys[i];
+						if (values)
+							valuesOut[dst] = (*values)[i];
+					}
+				}
+			});
+
+			keys.swap(keysOut);
+			if (values)
+				values->swap(valuesOut);
+		}
+	}
+
+	// Sorts count random keys, with their indices as values or without, on the GPU and on the CPU and reports both.
+	template<typename Key>
+	bool benchmarkSort(uint32_t count, bool withValues, PipelineLayoutCache& layouts, PipelineRegistry& registry, ThreadPool& threadPool)
+	{
+		std::mt19937_64 rng(1);
+		std::vector<Key> keys(count);
+		std::vector<uint32_t> values(withValues ? count : 0);
+		for (uint32_t i = 0; i < count; ++i)
+			keys[i] = static_cast<Key>(rng());
+		std::iota(values.begin(), values.end(), 0);
+
+		// GPU
+		vk::DeviceSize keySize = count * sizeof(Key);
+		vk::DeviceSize valueSize = values.size() * sizeof(uint32_t);
+		auto usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+		UniqueVmaAlloc<vk::Buffer> keyBuffer = Renderer::createBufferUnique(keySize, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		UniqueVmaAlloc<vk::Buffer> valueBuffer;
+		if (withValues)
+			valueBuffer = Renderer::createBufferUnique(valueSize, usage, VMA_MEMORY_USAGE_GPU_ONLY);
+
+		// Both arrays go through one staging buffer, there and back.
+		UniqueVmaAlloc<vk::Buffer> stagingBuffer = Renderer::createBufferUnique(keySize + valueSize, vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst, VMA_MEMORY_USAGE_GPU_TO_CPU);
+
+		char* data;
+		vmaMapMemory(vkRenderCtx.allocator, stagingBuffer->allocation, reinterpret_cast<void**>(&data));
+		memcpy(data, keys.data(), keySize);
+		memcpy(data + keySize, values.data(), valueSize);
+		vmaUnmapMemory(vkRenderCtx.allocator, stagingBuffer->allocation);
+
+		Renderer::copyBuffer(*stagingBuffer, *keyBuffer, { vk::BufferCopy{ 0, 0, keySize } });
+		if (withValues)
+			Renderer::copyBuffer(*stagingBuffer, *valueBuffer, { vk::BufferCopy{ keySize, 0, valueSize } });
+
+		RadixSort::KeyType keyType = sizeof(Key) == 8 ? RadixSort::KeyType::Uint64 : RadixSort::KeyType::Uint32;
+		RadixSort sort(count, keyType, keyBuffer->value, withValues ? valueBuffer->value : vk::Buffer(), layouts, registry);
+
+		double gpuSeconds = Renderer::timeCommands([&sort, count](vk::CommandBuffer cb) { sort.record(cb, count); });
+
+		Renderer::copyBuffer(*keyBuffer, *stagingBuffer, { vk::BufferCopy{ 0, 0, keySize } });
+		if (withValues)
+			Renderer::copyBuffer(*valueBuffer, *stagingBuffer, { vk::BufferCopy{ 0, keySize, valueSize } });
+
+		std::vector<Key> gpuKeys(count);
+		std::vector<uint32_t> gpuValues(values.size());
+		vmaMapMemory(vkRenderCtx.allocator, stagingBuffer->allocation, reinterpret_cast<void**>(&data));
+		memcpy(gpuKeys.data(), data, keySize);
+		memcpy(gpuValues.data(), data + keySize, valueSize);
+		vmaUnmapMemory(vkRenderCtx.allocator, stagingBuffer->allocation);
+
+		// CPU
+		auto start = std::chrono::high_resolution_clock::now();
+		RadixSort::SortCpu(keys, withValues ? &values : nullptr, threadPool);
+		double cpuSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		// Both sorts are stable, so the values have to match as well.
+		bool match = gpuKeys == keys && gpuValues == values;
+
+		std::cout << "Radix sort: " << count << ' ' << sizeof(Key) * 8 << " bit keys" << (withValues ? " with values" : "") << ", GPU "
+			<< gpuSeconds * 1000.0 << "ms (" << count / gpuSeconds * 1e-6 << " M keys/s), CPU "
+			<< cpuSeconds * 1000.0 << "ms (" << count / cpuSeconds * 1e-6 << " M keys/s, " << threadPool.size() << " threads), "
+			<< (match ? "results match" : "RESULTS DIFFER") << std::endl;
+
+		return match;
+	}
+}
+
+RadixSort::RadixSort(uint32_t maxCount, KeyType keyType, vk::Buffer keys, vk::Buffer values, PipelineLayoutCache& layouts, PipelineRegistry& registry) :
+	m_maxCount(maxCount),
+	m_keyBits(keyType == KeyType::Uint64 ? 64 : 32)
+{
+	if (maxCount == 0) throw std::runtime_error("Radix sort needs room for at least one key.");
+
+	uint32_t keyWords = m_keyBits / 32;
+
+	// Pipelines. The three passes share one layout, each digit binds the set for its direction and pushes its shift once.
+	const std::array<const char*, PassCount> paths{ {
+		"shaders/radix_sort_histogram.comp.spv",
+		"shaders/radix_sort_scan.comp.spv",
+		"shaders/radix_sort_scatter.comp.spv"
+	} };
+
+	std::vector<const Shader*> shaders;
+	for (auto path : paths)
+		shaders.push_back(&Shader::FetchShader(path));
+	PipelineInterface pipelineInterface = PipelineInterface::Reflect(shaders);
+	vk::PipelineLayout layout = layouts.getPipelineLayout(pipelineInterface);
+
+	const auto& limits = vkRenderCtx.physicalDeviceProperties.limits;
+	uint32_t groupSize = std::min({ 256u, limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations });
+
+	for (uint32_t pass = 0; pass < PassCount; ++pass)
+	{
+		m_passes[pass].setShader(paths[pass]);
+		m_passes[pass].specialize("local_size_x", groupSize);
+		m_passes[pass].specialize("KEY_WORDS", keyWords);
+		m_passes[pass].specialize("HAS_VALUES", static_cast<bool>(values));
+		m_passes[pass].setLayout(layout);
+		m_passes[pass].create(registry);
+	}
+
+	// Scratch keys and values every other pass writes to, and the digit counts of each workgroup.
+	{
+		auto usage = vk::BufferUsageFlagBits::eStorageBuffer;
+		uint32_t maxGroupCount = (maxCount + groupSize - 1) / groupSize;
+
+		m_scratchKeys = Renderer::createBufferUnique(maxCount * keyWords * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		if (values)
+			m_scratchValues = Renderer::createBufferUnique(maxCount * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_histograms = Renderer::createBufferUnique((1 << radixBits) * maxGroupCount * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+
+	// Descriptors
+	vk::DescriptorSetLayout setLayout = layouts.getDescriptorSetLayout(pipelineInterface.sets.at(0));
+
+	vk::DescriptorPoolSize poolSize{ vk::DescriptorType::eStorageBuffer, 10 };
+	m_descriptorPool = vkRenderCtx.device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{ {}, 2, 1, &poolSize });
+
+	std::vector<vk::DescriptorSetLayout> setLayouts(2, setLayout);
+	m_descriptorSets = vkRenderCtx.device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ *m_descriptorPool, 2, setLayouts.data() });
+
+	// Without values the value bindings alias the keys, the shaders never touch them then.
+	std::array<vk::DescriptorBufferInfo, 2> keyInfos{ { { keys, 0, VK_WHOLE_SIZE }, { m_scratchKeys->value, 0, VK_WHOLE_SIZE } } };
+	std::array<vk::DescriptorBufferInfo, 2> valueInfos = values ?
+		std::array<vk::DescriptorBufferInfo, 2>{ { { values, 0, VK_WHOLE_SIZE }, { m_scratchValues->value, 0, VK_WHOLE_SIZE } } } : keyInfos;
+	vk::DescriptorBufferInfo histograms{ m_histograms->value, 0, VK_WHOLE_SIZE };
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		vkRenderCtx.device.updateDescriptorSets({
+			vk::WriteDescriptorSet{ m_descriptorSets[i], 0, 0, 1, vk::DescriptorType::eStorageBuffer }.setPBufferInfo(&keyInfos[i]),
+			vk::WriteDescriptorSet{ m_descriptorSets[i], 1, 0, 1, vk::DescriptorType::eStorageBuffer }.setPBufferInfo(&keyInfos[1 - i]),
+			vk::WriteDescriptorSet{ m_descriptorSets[i], 2, 0, 1, vk::DescriptorType::eStorageBuffer }.setPBufferInfo(&valueInfos[i]),
+			vk::WriteDescriptorSet{ m_descriptorSets[i], 3, 0, 1, vk::DescriptorType::eStorageBuffer }.setPBufferInfo(&valueInfos[1 - i]),
+			vk::WriteDescriptorSet{ m_descriptorSets[i], 4, 0, 1, vk::DescriptorType::eStorageBuffer }.setPBufferInfo(&histograms)
+		}, {});
+	}
+}
+
+void RadixSort::record(vk::CommandBuffer cb, uint32_t count)
+{
+	if (count > m_maxCount) throw std::runtime_error("Radix sort was made for fewer keys than it was asked to sort.");
+	if (count == 0)
+		return;
+
+	const vk::AccessFlags readWrite = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+	auto barrier = [&cb, readWrite]() { ComputePipeline::barrier(cb, vk::PipelineStageFlagBits::eComputeShader, readWrite); };
+
+	uint32_t groupSize = m_passes[Scatter].workgroupSize()[0];
+	Params params{ count, (count + groupSize - 1) / groupSize, 0 };
+
+	for (params.shift = 0; params.shift < m_keyBits; params.shift += radixBits)
+	{
+		// Earlier passes read the histograms and the buffers this one writes.
+		if (params.shift != 0)
+			barrier();
+
+		m_passes[Histogram].bind(cb);
+		m_passes[Histogram].bindDescriptorSets(cb, 0, { m_descriptorSets[(params.shift / radixBits) % 2] });
+		m_passes[Histogram].pushConstants(cb, 0, sizeof(params), &params);
+		m_passes[Histogram].dispatch(cb, params.groupCount);
+		barrier();
+
+		// One workgroup walks all the histograms.
+		m_passes[Scan].bind(cb);
+		m_passes[Scan].dispatch(cb, 1);
+		barrier();
+
+		m_passes[Scatter].bind(cb);
+		m_passes[Scatter].dispatch(cb, params.groupCount);
+	}
+}
+
+std::vector<ComputePipeline*> RadixSort::pipelines()
+{
+	std::vector<ComputePipeline*> pipelines;
+	for (auto& pass : m_passes)
+		pipelines.push_back(&pass);
+	return pipelines;
+}
+
+void RadixSort::SortCpu(std::vector<uint32_t>& keys, std::vector<uint32_t>* values, ThreadPool& threadPool)
+{
+	radixSortCpu(keys, values, threadPool);
+}
+
+void RadixSort::SortCpu(std::vector<uint64_t>& keys, std::vector<uint32_t>* values, ThreadPool& threadPool)
+{
+	radixSortCpu(keys, values, threadPool);
+}
+
+bool RadixSort::Benchmark(uint32_t count, PipelineLayoutCache& layouts, PipelineRegistry& registry, ThreadPool& threadPool)
+{
+	if (count == 0)
+		return true;
+
+	bool match = true;
+	for (bool withValues : { true, false })
+	{
+		match &= benchmarkSort<uint32_t>(count, withValues, layouts, registry, threadPool);
+		match &= benchmarkSort<uint64_t>(count, withValues, layouts, registry, threadPool);
+	}
+	return match;
+}
@@ -0,0 +1,65 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <vulkan/vulkan.hpp>
+#include <array>
+#include <vector>
+#include "globals.h"
+#include "pipeline.h"
+#include "thread_pool.h"
+
+// Stable GPU sort of 32 or 64 bit unsigned keys, optionally carrying a 32 bit value per key.
+// Sorts in place: every pass goes between the caller's buffers and scratch copies, and there is an even number of them.
+class RadixSort
+{
+public:
+	enum class KeyType
+	{
+		Uint32,
+		Uint64 // Two uints per key, low word first.
+	};
+
+	// Sorts up to maxCount keys of the buffers, values may be null for a key only sort.
+	RadixSort(uint32_t maxCount, KeyType keyType, vk::Buffer keys, vk::Buffer values, PipelineLayoutCache& layouts, PipelineRegistry& registry);
+
+	// Records a sort of the first count keys. Commands reading the result need their own barrier.
+	void record(vk::CommandBuffer cb, uint32_t count);
+
+	// For shader reloads.
+	std::vector<ComputePipeline*> pipelines();
+
+	// The same stable sort on the CPU, split over the pool's threads.
+	static void SortCpu(std::vector<uint32_t>& keys, std::vector<uint32_t>* values, ThreadPool& threadPool);
+	static void SortCpu(std::vector<uint64_t>& keys, std::vector<uint32_t>* values, ThreadPool& threadPool);
+
+	// Sorts count random keys on the GPU and on the CPU, 32 and 64 bit and each with and without values.
+	// Reports both rates in keys per second and returns whether every result agrees.
+	static bool Benchmark(uint32_t count, PipelineLayoutCache& layouts, PipelineRegistry& registry, ThreadPool& threadPool);
+
+private:
+	enum Pass
+	{
+		Histogram,
+		Scan,
+		Scatter,
+		PassCount
+	};
+
+	static constexpr uint32_t radixBits = 4; // RADIX_BITS in shaders/radix_sort.glsl.
+
+	uint32_t m_maxCount;
+	uint32_t m_keyBits;
+
+	UniqueVmaAlloc<vk::Buffer> m_scratchKeys;
+	UniqueVmaAlloc<vk::Buffer> m_scratchValues;
+	UniqueVmaAlloc<vk::Buffer> m_histograms;
+
+	std::array<ComputePipeline, PassCount> m_passes;
+	vk::UniqueDescriptorPool m_descriptorPool;
+	std::vector<vk::DescriptorSet> m_descriptorSets; // Set 0 sorts from the caller's buffers into the scratch ones, set 1 back.
+};
+
+#endif
@@ -0,0 +1,446 @@
+#include "stdafx.h"
+
+#include "reflection.h"
+
+#include <unordered_map>
+
+namespace
+{
+	const uint32_t SpirvMagic = 0x07230203;
+	const size_t SpirvHeaderWords = 5;
+
+	// The subset of the SPIR-V spec needed to find a module's interface.
+	enum Op : uint32_t
+	{
+		OpName = 5,
+		OpEntryPoint = 15,
+		OpExecutionMode = 16,
+		OpTypeInt = 21,
+		OpTypeFloat = 22,
+		OpTypeVector = 23,
+		OpTypeMatrix = 24,
+		OpTypeImage = 25,
+		OpTypeSampler = 26,
+		OpTypeSampledImage = 27,
+		OpTypeArray = 28,
+		OpTypeRuntimeArray = 29,
+		OpTypeStruct = 30,
+		OpTypePointer = 32,
+		OpTypeBool = 20,
+		OpConstant = 43,
+		OpSpecConstantTrue = 48,
+		OpSpecConstantFalse = 49,
+		OpSpecConstant = 50,
+		OpSpecConstantComposite = 51,
+		OpVariable = 59,
+		OpDecorate = 71,
+		OpMemberDecorate = 72,
+	};
+
+	enum Decoration : uint32_t
+	{
+		DecorationSpecId = 1,
+		DecorationBlock = 2,
+		DecorationBufferBlock = 3,
+		DecorationArrayStride = 6,
+		DecorationMatrixStride = 7,
+		DecorationBuiltIn = 11,
+		DecorationLocation = 30,
+		DecorationBinding = 33,
+		DecorationDescriptorSet = 34,
+		DecorationOffset = 35,
+	};
+
+	enum StorageClass : uint32_t
+	{
+		StorageClassUniformConstant = 0,
+		StorageClassInput = 1,
+		StorageClassUniform = 2,
+		StorageClassPushConstant = 9,
+		StorageClassStorageBuffer = 12,
+	};
+
+	const uint32_t ExecutionModeLocalSize = 17;
+	const uint32_t BuiltInWorkgroupSize = 25;
+	const uint32_t DimBuffer = 5;
+
+	struct Decorations
+	{
+		uint32_t set = 0;
+		uint32_t binding = ~0u;
+		uint32_t location = ~0u;
+		uint32_t arrayStride = 0;
+		uint32_t specId = ~0u;
+		uint32_t builtInKind = ~0u;
+		bool builtIn = false;
+		bool block = false;
+		bool bufferBlock = false;
+	};
+
+	struct MemberDecorations
+	{
+		uint32_t offset = 0;
+		uint32_t matrixStride = 0;
+	};
+
+	struct Type
+	{
+		uint32_t op;
+		std::vector<uint32_t> operands; // Everything after the result id.
+	};
+
+	struct Variable
+	{
+		uint32_t id;
+		uint32_t pointerType;
+		uint32_t storageClass;
+	};
+
+	std::string readString(const uint32_t* words, size_t wordCount)
+	{
+		const char* chars = reinterpret_cast<const char*>(words);
+		size_t length = 0;
+		while (length < wordCount * 4 && chars[length] != '\0')
+			++length;
+		return std::string(chars, length);
+	}
+
+	vk::ShaderStageFlagBits stageOf(uint32_t executionModel)
+	{
+		switch (executionModel)
+		{
+		case 0: return vk::ShaderStageFlagBits::eVertex;
+		case 1: return vk::ShaderStageFlagBits::eTessellationControl;
+		case 2: return vk::ShaderStageFlagBits::eTessellationEvaluation;
+		case 3: return vk::ShaderStageFlagBits::eGeometry;
+		case 4: return vk::ShaderStageFlagBits::eFragment;
+		case 5: return vk::ShaderStageFlagBits::eCompute;
+		}
+		throw std::runtime_error("Unsupported execution model: " + std::to_string(executionModel));
+	}
+
+	class Module
+	{
+	public:
+		std::unordered_map<uint32_t, std::string> names;
+		std::unordered_map<uint32_t, Decorations> decorations;
+		std::unordered_map<uint32_t, std::vector<MemberDecorations>> memberDecorations;
+		std::unordered_map<uint32_t, Type> types;
+		std::unordered_map<uint32_t, uint32_t> constants;
+		std::vector<Variable> variables;
+		std::vector<std::pair<uint32_t, uint32_t>> specConstants; // (id, type)
+		std::vector<std::pair<uint32_t, std::vector<uint32_t>>> specComposites; // (id, constituents)
+
+		const Type& type(uint32_t id) const
+		{
+			auto it = types.find(id);
+			if (it == types.end()) throw std::runtime_error("SPIR-V references undefined type " + std::to_string(id));
+			return it->second;
+		}
+
+		uint32_t constant(uint32_t id) const
+		{
+			auto it = constants.find(id);
+			if (it == constants.end()) throw std::runtime_error("SPIR-V array length is not a constant, id " + std::to_string(id));
+			return it->second;
+		}
+
+		std::string name(uint32_t id) const
+		{
+			auto it = names.find(id);
+			return it == names.end() ? std::string{} : it->second;
+		}
+
+		const Decorations& decoration(uint32_t id) const
+		{
+			static const Decorations none;
+			auto it = decorations.find(id);
+			return it == decorations.end() ? none : it->second;
+		}
+
+		// Size as laid out in a buffer block, the explicit strides from the decorations win over tight packing.
+		uint32_t sizeOf(uint32_t typeId, uint32_t matrixStride = 0) const
+		{
+			const Type& t = type(typeId);
+			switch (t.op)
+			{
+			case OpTypeInt:
+			case OpTypeFloat:
+				return t.operands[0] / 8;
+			case OpTypeVector:
+				return t.operands[1] * sizeOf(t.operands[0]);
+			case OpTypeMatrix:
+				return t.operands[1] * (matrixStride ? matrixStride : sizeOf(t.operands[0]));
+			case OpTypeArray:
+			{
+				uint32_t stride = decoration(typeId).arrayStride;
+				return constant(t.operands[1]) * (stride ? stride : sizeOf(t.operands[0]));
+			}
+			case OpTypeRuntimeArray:
+				return 0;
+			case OpTypeStruct:
+			{
+				auto it = memberDecorations.find(typeId);
+				uint32_t size = 0;
+				for (size_t i = 0; i < t.operands.size(); ++i)
+				{
+					MemberDecorations member = it != memberDecorations.end() && i < it->second.size() ? it->second[i] : MemberDecorations{};
+					size = std::max(size, member.offset + sizeOf(t.operands[i], member.matrixStride));
+				}
+				return size;
+			}
+			}
+			throw std::runtime_error("Can't size SPIR-V type " + std::to_string(typeId));
+		}
+
+		vk::Format vertexFormat(uint32_t typeId) const
+		{
+			const Type& t = type(typeId);
+			uint32_t components = 1;
+			const Type* scalar = &t;
+			if (t.op == OpTypeVector)
+			{
+				components = t.operands[1];
+				scalar = &type(t.operands[0]);
+			}
+
+			if (scalar->operands[0] != 32 || components < 1 || components > 4)
+				return vk::Format::eUndefined;
+
+			static const vk::Format floats[] = { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat };
+			static const vk::Format sints[] = { vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint };
+			static const vk::Format uints[] = { vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint };
+
+			if (scalar->op == OpTypeFloat)
+				return floats[components - 1];
+			if (scalar->op == OpTypeInt)
+				return scalar->operands[1] ? sints[components - 1] : uints[components - 1];
+			return vk::Format::eUndefined;
+		}
+	};
+}
+
+ShaderReflection ShaderReflection::Reflect(const uint32_t* code, size_t wordCount, const std::string& path)
+{
+	if (wordCount < SpirvHeaderWords || code[0] != SpirvMagic) throw std::runtime_error("Not a SPIR-V module. Path = " + path);
+
+	ShaderReflection reflection;
+	Module module;
+
+	for (size_t i = SpirvHeaderWords; i < wordCount;)
+	{
+		uint32_t op = code[i] & 0xFFFF;
+		uint32_t length = code[i] >> 16;
+		if (length == 0 || i + length > wordCount) throw std::runtime_error("Malformed SPIR-V instruction. Path = " + path);
+
+		const uint32_t* operands = code + i + 1;
+		size_t operandCount = length - 1;
+
+		switch (op)
+		{
+		case OpName:
+			module.names[operands[0]] = readString(operands + 1, operandCount - 1);
+			break;
+		case OpEntryPoint:
+			reflection.m_entryPoints.push_back({ readString(operands + 2, operandCount - 2), stageOf(operands[0]) });
+			break;
+		case OpExecutionMode:
+			if (operands[1] == ExecutionModeLocalSize && operandCount >= 5)
+				reflection.m_localSize = { operands[2], operands[3], operands[4] };
+			break;
+		case OpTypeBool:
+		case OpTypeInt:
+		case OpTypeFloat:
+		case OpTypeVector:
+		case OpTypeMatrix:
+		case OpTypeImage:
+		case OpTypeSampler:
+		case OpTypeSampledImage:
+		case OpTypeArray:
+		case OpTypeRuntimeArray:
+		case OpTypeStruct:
+		case OpTypePointer:
+			module.types[operands[0]] = Type{ op, std::vector<uint32_t>(operands + 1, operands + operandCount) };
+			break;
+		case OpConstant:
+			module.constants[operands[1]] = operands[2];
+			break;
+		case OpSpecConstant:
+			module.constants[operands[1]] = operands[2];
+			module.specConstants.push_back({ operands[1], operands[0] });
+			break;
+		case OpSpecConstantTrue:
+		case OpSpecConstantFalse:
+			module.specConstants.push_back({ operands[1], operands[0] });
+			break;
+		case OpSpecConstantComposite:
+			module.specComposites.push_back({ operands[1], std::vector<uint32_t>(operands + 2, operands + operandCount) });
+			break;
+		case OpVariable:
+			module.variables.push_back({ operands[1], operands[0], operands[2] });
+			break;
+		case OpDecorate:
+		{
+			Decorations& decoration = module.decorations[operands[0]];
+			switch (operands[1])
+			{
+			case DecorationBlock: decoration.block = true; break;
+			case DecorationBufferBlock: decoration.bufferBlock = true; break;
+			case DecorationArrayStride: decoration.arrayStride = operands[2]; break;
+			case DecorationSpecId: decoration.specId = operands[2]; break;
+			case DecorationBuiltIn: decoration.builtIn = true; decoration.builtInKind = operands[2]; break;
+			case DecorationLocation: decoration.location = operands[2]; break;
+			case DecorationBinding: decoration.binding = operands[2]; break;
+			case DecorationDescriptorSet: decoration.set = operands[2]; break;
+			}
+			break;
+		}
+		case OpMemberDecorate:
+		{
+			auto& members = module.memberDecorations[operands[0]];
+			if (members.size() <= operands[1])
+				members.resize(operands[1] + 1);
+			if (operands[2] == DecorationOffset)
+				members[operands[1]].offset = operands[3];
+			else if (operands[2] == DecorationMatrixStride)
+				members[operands[1]].matrixStride = operands[3];
+			break;
+		}
+		}
+
+		i += length;
+	}
+
+	// local_size_x_id and friends only show up as the constituents of the gl_WorkGroupSize composite.
+	for (auto& composite : module.specComposites)
+	{
+		if (module.decoration(composite.first).builtInKind != BuiltInWorkgroupSize) continue;
+
+		static const char* axes[] = { "local_size_x", "local_size_y", "local_size_z" };
+		for (size_t i = 0; i < composite.second.size() && i < 3; ++i)
+		{
+			if (module.names.find(composite.second[i]) == module.names.end())
+				module.names[composite.second[i]] = axes[i];
+		}
+	}
+
+	for (auto& constant : module.specConstants)
+	{
+		uint32_t specId = module.decoration(constant.first).specId;
+		if (specId == ~0u) continue;
+
+		// Booleans are specialized with a VkBool32.
+		const Type& type = module.type(constant.second);
+		uint32_t size = type.op == OpTypeBool ? 4 : module.sizeOf(constant.second);
+		reflection.m_specializationConstants.push_back({ module.name(constant.first), specId, size });
+	}
+
+	bool vertex = reflection.findEntryPoint(vk::ShaderStageFlagBits::eVertex) != nullptr;
+
+	for (auto& variable : module.variables)
+	{
+		const Type& pointer = module.type(variable.pointerType);
+		uint32_t typeId = pointer.operands[1];
+		const Decorations& decoration = module.decoration(variable.id);
+
+		if (variable.storageClass == StorageClassInput)
+		{
+			if (vertex && !decoration.builtIn && decoration.location != ~0u)
+				reflection.m_vertexInputs.push_back({ module.name(variable.id), decoration.location, module.vertexFormat(typeId) });
+			continue;
+		}
+
+		if (variable.storageClass == StorageClassPushConstant)
+		{
+			reflection.m_pushConstants.push_back(vk::PushConstantRange{ {}, 0, module.sizeOf(typeId) });
+			continue;
+		}
+
+		if (variable.storageClass != StorageClassUniformConstant && variable.storageClass != StorageClassUniform && variable.storageClass != StorageClassStorageBuffer)
+			continue;
+
+		// Arrays of resources turn into the descriptor count.
+		uint32_t count = 1;
+		const Type* type = &module.type(typeId);
+		if (type->op == OpTypeArray)
+		{
+			count = module.constant(type->operands[1]);
+			typeId = type->operands[0];
+			type = &module.type(typeId);
+		}
+		else if (type->op == OpTypeRuntimeArray)
+		{
+			count = 0;
+			typeId = type->operands[0];
+			type = &module.type(typeId);
+		}
+
+		vk::DescriptorType descriptorType;
+		switch (type->op)
+		{
+		case OpTypeSampler:
+			descriptorType = vk::DescriptorType::eSampler;
+			break;
+		case OpTypeSampledImage:
+			descriptorType = vk::DescriptorType::eCombinedImageSampler;
+			break;
+		case OpTypeImage:
+		{
+			// Operands: sampled type, dim, depth, arrayed, ms, sampled (1 = with sampler, 2 = storage), format.
+			bool buffer = type->operands[1] == DimBuffer;
+			bool storage = type->operands[5] == 2;
+			descriptorType = buffer
+				? (storage ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer)
+				: (storage ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage);
+			break;
+		}
+		case OpTypeStruct:
+			// Before SPIR-V 1.3 storage buffers are Uniform blocks decorated BufferBlock.
+			descriptorType = variable.storageClass == StorageClassStorageBuffer || module.decoration(typeId).bufferBlock
+				? vk::DescriptorType::eStorageBuffer
+				: vk::DescriptorType::eUniformBuffer;
+			break;
+		default:
+			throw std::runtime_error("Unsupported resource type for " + module.name(variable.id) + ". Path = " + path);
+		}
+
+		reflection.m_bindings.push_back({ module.name(variable.id), decoration.set, decoration.binding, descriptorType, count });
+	}
+
+	std::sort(reflection.m_bindings.begin(), reflection.m_bindings.end(), [](const DescriptorBinding& a, const DescriptorBinding& b)
+	{
+		return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+	});
+	std::sort(reflection.m_specializationConstants.begin(), reflection.m_specializationConstants.end(), [](const SpecializationConstant& a, const SpecializationConstant& b)
+	{
+		return a.id < b.id;
+	});
+	std::sort(reflection.m_vertexInputs.begin(), reflection.m_vertexInputs.end(), [](const VertexInput& a, const VertexInput& b)
+	{
+		return a.location < b.location;
+	});
+
+	if (reflection.m_entryPoints.empty()) throw std::runtime_error("SPIR-V module has no entry point. Path = " + path);
+
+	return reflection;
+}
+
+const ShaderReflection::SpecializationConstant* ShaderReflection::findSpecializationConstant(const std::string& name) const
+{
+	for (auto& constant : m_specializationConstants)
+	{
+		if (constant.name == name)
+			return &constant;
+	}
+	return nullptr;
+}
+
+const ShaderReflection::EntryPoint* ShaderReflection::findEntryPoint(vk::ShaderStageFlagBits stage) const
+{
+	for (auto& entryPoint : m_entryPoints)
+	{
+		if (entryPoint.stage == stage)
+			return &entryPoint;
+	}
+	return nullptr;
+}
@@ -0,0 +1,90 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef REFLECTION_H
+#define REFLECTION_H
+
+#include <vulkan/vulkan.hpp>
+#include <array>
+#include <string>
+#include <vector>
+
+// Interface of a SPIR-V module as seen from the pipeline: entry points, resources and vertex inputs.
+class ShaderReflection
+{
+public:
+	struct EntryPoint
+	{
+		std::string name;
+		vk::ShaderStageFlagBits stage;
+	};
+
+	struct DescriptorBinding
+	{
+		std::string name;
+		uint32_t set;
+		uint32_t binding;
+		vk::DescriptorType type;
+		uint32_t count; // 0 for runtime sized arrays, the size is only known when the layout is built.
+	};
+
+	struct SpecializationConstant
+	{
+		std::string name; // Workgroup size constants are named local_size_x/y/z.
+		uint32_t id;
+		uint32_t size;
+	};
+
+	struct VertexInput
+	{
+		std::string name;
+		uint32_t location;
+		vk::Format format;
+	};
+
+	static ShaderReflection Reflect(const uint32_t* code, size_t wordCount, const std::string& path);
+
+	const std::vector<EntryPoint>& entryPoints() const
+	{
+		return m_entryPoints;
+	}
+	const std::vector<DescriptorBinding>& bindings() const
+	{
+		return m_bindings;
+	}
+	// Offsets and sizes of push constant blocks, with no stage flags set.
+	const std::vector<vk::PushConstantRange>& pushConstants() const
+	{
+		return m_pushConstants;
+	}
+	// Sorted by constant id.
+	const std::vector<SpecializationConstant>& specializationConstants() const
+	{
+		return m_specializationConstants;
+	}
+	const SpecializationConstant* findSpecializationConstant(const std::string& name) const;
+	// Only filled for vertex shaders, sorted by location.
+	const std::vector<VertexInput>& vertexInputs() const
+	{
+		return m_vertexInputs;
+	}
+	// Workgroup size of compute entry points, zero if not declared with a constant.
+	const std::array<uint32_t, 3>& localSize() const
+	{
+		return m_localSize;
+	}
+
+	const EntryPoint* findEntryPoint(vk::ShaderStageFlagBits stage) const;
+
+private:
+	ShaderReflection() = default;
+
+	std::vector<EntryPoint> m_entryPoints;
+	std::vector<DescriptorBinding> m_bindings;
+	std::vector<vk::PushConstantRange> m_pushConstants;
+	std::vector<SpecializationConstant> m_specializationConstants;
+	std::vector<VertexInput> m_vertexInputs;
+	std::array<uint32_t, 3> m_localSize{};
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include <iterator>
 #include <functional>
 #include "shader.h"
+#include "texture.h"
 
 VkResult vkCreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback)
 {
@@ -19,6 +20,23 @@ void vkDestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackE
 	pfn_vkDestroyDebugReportCallbackEXT(instance, callback, pAllocator);
 }
 
+void vkGetPhysicalDeviceFeatures2KHR(VkPhysicalDevice physicalDevice, VkPhysicalDeviceFeatures2KHR* pFeatures)
+{
+	auto pfn_vkGetPhysicalDeviceFeatures2KHR = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(vkGetInstanceProcAddr(vkRenderCtx.instance, "vkGetPhysicalDeviceFeatures2KHR"));
+	pfn_vkGetPhysicalDeviceFeatures2KHR(physicalDevice, pFeatures);
+}
+
+void vkGetPhysicalDeviceProperties2KHR(VkPhysicalDevice physicalDevice, VkPhysicalDeviceProperties2KHR* pProperties)
+{
+	auto pfn_vkGetPhysicalDeviceProperties2KHR = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(vkGetInstanceProcAddr(vkRenderCtx.instance, "vkGetPhysicalDeviceProperties2KHR"));
+	pfn_vkGetPhysicalDeviceProperties2KHR(physicalDevice, pProperties);
+}
+
+static bool hasExtension(const std::vector<vk::ExtensionProperties>& available, const char* name)
+{
+	return std::any_of(available.begin(), available.end(), [name](const vk::ExtensionProperties& ext) { return strcmp(ext.extensionName, name) == 0; });
+}
+
 
 const vk::PipelineVertexInputStateCreateInfo GraphicsPipelineDefaults::vertexInputState;
 const vk::PipelineInputAssemblyStateCreateInfo GraphicsPipelineDefaults::inputAssemblyState{ {}, vk::PrimitiveTopology::eTriangleList };
@@ -35,13 +53,26 @@ const vk::PipelineColorBlendAttachmentState colorBlendAttachment = vk::PipelineC
 	vk::ColorComponentFlagBits::eA
 );
 
+const vk::PipelineColorBlendAttachmentState additiveBlendAttachment{
+	true,
+	vk::BlendFactor::eOne, vk::BlendFactor::eOne, vk::BlendOp::eAdd,
+	vk::BlendFactor::eOne, vk::BlendFactor::eOne, vk::BlendOp::eAdd,
+	colorBlendAttachment.colorWriteMask
+};
+
 const vk::PipelineColorBlendStateCreateInfo GraphicsPipelineDefaults::colorBlendState{ {}, false, vk::LogicOp::eCopy, 1, &colorBlendAttachment };
 const vk::PipelineDynamicStateCreateInfo GraphicsPipelineDefaults::dynamicState;
 
 
-void Renderer::init()
+Renderer::~Renderer()
+{
+	// Every exit path, not just the end of loop(), otherwise the pool would decode the whole queue before it joins.
+	m_stopStreaming = true;
+}
+
+void Renderer::init(const Window& window)
 {
-	initWindow();
+	m_window = window.handle();
 	initCoreRenderer();
 }
 
@@ -52,20 +83,51 @@ const std::vector<sprite_vertex> quad = {
 	{ glm::vec2( 1.0f,  1.0f), glm::vec2(1.0f, 1.0f) }
 };
 
+// From this many particles on they are drawn as points.
+const uint32_t pointParticleCount = 1 << 20;
+
 void Renderer::loadScene(const Scene& scene)
 {
 
-	std::vector<Sprite> sorted_sprites = scene.sprites();
-	std::sort(sorted_sprites.begin(), sorted_sprites.end(), [](const Sprite& a, const Sprite& b) { return a.textureId < b.textureId; });
+	bool fitsBindless = scene.textures().size() <= m_descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSampledImages
+		&& scene.textures().size() <= m_descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers;
+	m_textureMode = (m_descriptorIndexing && fitsBindless && !scene.textures().empty()) ? TextureMode::Bindless : TextureMode::Array;
 
-	initPipelineLayout();
+	m_particleDrawMode = scene.particleCount() >= pointParticleCount ? ParticleDrawMode::Points : ParticleDrawMode::Billboards;
+
+	initPipelineLayout(static_cast<uint32_t>(scene.textures().size()));
 	initPipelines();
 
-	initBuffers(sorted_sprites, scene.objFiles(), scene.objects());
 	initTextures(scene.textures());
 
+	// Only the array a sprite samples from forces a draw split, so within an array (or always, when bindless) scene order is kept.
+	std::vector<Sprite> sorted_sprites = scene.sprites();
+	std::stable_sort(sorted_sprites.begin(), sorted_sprites.end(), [this](const Sprite& a, const Sprite& b) { return m_textureLocations[a.textureId].first < m_textureLocations[b.textureId].first; });
+
+	initBuffers(sorted_sprites, scene.objFiles(), scene.objects());
+
 	initDescriptorSets(scene.objects().size());
-	initCommandBuffers(sorted_sprites, scene.objects());
+
+	// Before the command buffers, which draw the particles.
+	if (scene.particleCount() > 0)
+	{
+		m_particles = std::make_unique<ParticleSimulation>(ParticleState::Disk(scene.particleCount()), m_pipelineLayouts, m_pipelineRegistry,
+			ParticleSimulation::ParseSolver(scene.particleSolver()));
+
+		// The compute passes compiled alongside each other, a shader reload must not retire a module one of them still reads.
+		m_pipelineRegistry.wait();
+	}
+
+	m_sprites = std::move(sorted_sprites);
+	m_objects = scene.objects();
+	initCommandBuffers(m_sprites, m_objects);
+
+	// Sprites are placed in clip space and never move, so which images can show on screen is known up front.
+	for (auto& sprite : m_sprites)
+	{
+		if (std::abs(sprite.pos.x) - std::abs(sprite.scale.x) <= 1.0f && std::abs(sprite.pos.y) - std::abs(sprite.scale.y) <= 1.0f)
+			m_textureResidency[m_textureMode == TextureMode::Bindless ? sprite.textureId : m_textureLocations[sprite.textureId].first].visible = true;
+	}
 
 }
 
@@ -78,23 +140,30 @@ void Renderer::loop()
 
 	auto time = clock.now();
 
-	while (!glfwWindowShouldClose(m_window.get()))
+	while (processCommands())
 	{
 
 		auto oldTime = std::exchange(time, clock.now());
 
 		std::chrono::duration<float> tDiff = time - oldTime;
 
-		updateBuffers(tDiff.count());
-		renderFrame();
+		// The camera moves with the frame time, the simulation in whole steps of its own.
+		uint32_t simulationSteps = m_simulationTimestep.advance(tDiff.count());
 
-		glfwPollEvents();
+		updateBuffers(tDiff.count());
+		updateTextureStreaming();
+		updateTextureResidency();
+		updateShaderReload();
+		renderFrame(simulationSteps);
 
 		m_currentFrame++;
 	}
 
+	m_stopStreaming = true;
 	m_device->waitIdle();
 
+	savePipelineCache();
+
 	Shader::FreeShaders();
 	
 }
@@ -118,14 +187,22 @@ void Renderer::mouseMoved(float x, float y)
 }
 
 
-VmaAlloc<vk::Buffer> Renderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaMemoryUsage memUsage)
+VmaAlloc<vk::Buffer> Renderer::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaMemoryUsage memUsage, bool shared)
 {
 	VmaAlloc<vk::Buffer> alloc;
 
 	vk::BufferCreateInfo createInfo{
-		{}, size, usage, vk::SharingMode::eExclusive // For now we only have 1 queue.
+		{}, size, usage, vk::SharingMode::eExclusive
 	};
 
+	uint32_t queueFamilies[] = { vkRenderCtx.queueFamily, vkRenderCtx.computeQueueFamily };
+	if (shared && queueFamilies[0] != queueFamilies[1])
+	{
+		createInfo.sharingMode = vk::SharingMode::eConcurrent;
+		createInfo.queueFamilyIndexCount = 2;
+		createInfo.pQueueFamilyIndices = queueFamilies;
+	}
+
 	VmaAllocationCreateInfo allocInfo = {};
 	allocInfo.usage = memUsage;
 
@@ -134,9 +211,9 @@ VmaAlloc<vk::Buffer> Renderer::createBuffer(vk::DeviceSize size, vk::BufferUsage
 	return alloc;
 }
 
-UniqueVmaAlloc<vk::Buffer> Renderer::createBufferUnique(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaMemoryUsage memUsage)
+UniqueVmaAlloc<vk::Buffer> Renderer::createBufferUnique(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaMemoryUsage memUsage, bool shared)
 {
-	return UniqueVmaAlloc<vk::Buffer>(createBuffer(size, usage, memUsage), vkRenderCtx.allocator);
+	return UniqueVmaAlloc<vk::Buffer>(createBuffer(size, usage, memUsage, shared), vkRenderCtx.allocator);
 }
 
 void Renderer::copyBuffer(VmaAlloc<vk::Buffer> src, VmaAlloc<vk::Buffer> dst)
@@ -174,7 +251,47 @@ void Renderer::copyBuffer(VmaAlloc<vk::Buffer> src, VmaAlloc<vk::Buffer> dst, co
 	vkRenderCtx.device.waitForFences({ *fence }, true, std::numeric_limits<uint64_t>::max());
 }
 
-void transitionImageLayout(vk::CommandBuffer cb, vk::Image image, vk::Format imageFormat, vk::ImageLayout oldLayout, vk::ImageLayout newLayout)
+double Renderer::timeCommands(const std::function<void(vk::CommandBuffer)>& record)
+{
+	auto cb = std::move(vkRenderCtx.device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{ vkRenderCtx.commandPool, vk::CommandBufferLevel::ePrimary, 1 }).front());
+
+	// Timestamps measure the commands alone, without the submission around them.
+	bool timestamps = vkRenderCtx.physicalDevice.getQueueFamilyProperties()[vkRenderCtx.queueFamily].timestampValidBits != 0;
+	vk::UniqueQueryPool queryPool;
+	if (timestamps)
+		queryPool = vkRenderCtx.device.createQueryPoolUnique(vk::QueryPoolCreateInfo{ {}, vk::QueryType::eTimestamp, 2 });
+
+	cb->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+	if (timestamps)
+	{
+		cb->resetQueryPool(*queryPool, 0, 2);
+		cb->writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, *queryPool, 0);
+	}
+	record(cb.get());
+	if (timestamps)
+		cb->writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, *queryPool, 1);
+	cb->end();
+
+	auto fence = vkRenderCtx.device.createFenceUnique(vk::FenceCreateInfo{});
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	vkRenderCtx.queue.submit({ vk::SubmitInfo{ 0, nullptr, nullptr, 1, &cb.get() } }, *fence);
+	vkRenderCtx.device.waitForFences({ *fence }, true, std::numeric_limits<uint64_t>::max());
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	if (timestamps)
+	{
+		std::array<uint64_t, 2> ticks;
+		vkRenderCtx.device.getQueryPoolResults<uint64_t>(*queryPool, 0, 2, ticks, sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+		seconds = (ticks[1] - ticks[0]) * static_cast<double>(vkRenderCtx.physicalDeviceProperties.limits.timestampPeriod) * 1e-9;
+	}
+
+	return seconds;
+}
+
+void transitionImageLayout(vk::CommandBuffer cb, vk::Image image, vk::Format imageFormat, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, uint32_t layerCount = 1, uint32_t baseMipLevel = 0, uint32_t levelCount = 1)
 {
 	vk::PipelineStageFlags srcStage, dstStage;
 	vk::AccessFlags srcAccess, dstAccess;
@@ -187,12 +304,27 @@ void transitionImageLayout(vk::CommandBuffer cb, vk::Image image, vk::Format ima
 		srcStage = vk::PipelineStageFlagBits::eTransfer;
 		srcAccess = vk::AccessFlagBits::eTransferWrite;
 	}
+	else if (oldLayout == vk::ImageLayout::eTransferSrcOptimal)
+	{
+		srcStage = vk::PipelineStageFlagBits::eTransfer;
+		srcAccess = vk::AccessFlagBits::eTransferRead;
+	}
+	else if (oldLayout == vk::ImageLayout::eShaderReadOnlyOptimal)
+	{
+		srcStage = vk::PipelineStageFlagBits::eFragmentShader;
+		srcAccess = vk::AccessFlagBits::eShaderRead;
+	}
 
 	if (newLayout == vk::ImageLayout::eTransferDstOptimal)
 	{
 		dstStage = vk::PipelineStageFlagBits::eTransfer;
 		dstAccess = vk::AccessFlagBits::eTransferWrite;
 	}
+	else if (newLayout == vk::ImageLayout::eTransferSrcOptimal)
+	{
+		dstStage = vk::PipelineStageFlagBits::eTransfer;
+		dstAccess = vk::AccessFlagBits::eTransferRead;
+	}
 	else if (newLayout == vk::ImageLayout::eShaderReadOnlyOptimal)
 	{
 		dstStage = vk::PipelineStageFlagBits::eFragmentShader;
@@ -215,118 +347,233 @@ void transitionImageLayout(vk::CommandBuffer cb, vk::Image image, vk::Format ima
 				VK_QUEUE_FAMILY_IGNORED,
 				VK_QUEUE_FAMILY_IGNORED,
 				image,
-				vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 }
+				vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, baseMipLevel, levelCount, 0, layerCount }
 			}
 		}
 	);
 }
 
-VmaAlloc<vk::Image> Renderer::createImage(const std::string& path)
+// Expects every level in eTransferDstOptimal with level 0 filled, leaves every level in eShaderReadOnlyOptimal.
+void generateMipmaps(vk::CommandBuffer cb, vk::Image image, vk::Format format, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t layerCount)
 {
-	UniqueVmaAlloc<vk::Buffer> stagingBuffer;
-	vk::DeviceSize imageSize;
-	uint32_t width, height;
-
+	for (uint32_t level = 1; level < mipLevels; ++level)
 	{
-		int channels;
-		using unique_image = std::unique_ptr<stbi_uc, void(*)(void*)>;
-		unique_image pixels = unique_image{ stbi_load(path.c_str(), reinterpret_cast<int*>(&width), reinterpret_cast<int*>(&height), &channels, STBI_rgb_alpha), stbi_image_free };
+		transitionImageLayout(cb, image, format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, layerCount, level - 1, 1);
+
+		int32_t srcWidth = std::max(width >> (level - 1), 1u), srcHeight = std::max(height >> (level - 1), 1u);
+		int32_t dstWidth = std::max(width >> level, 1u), dstHeight = std::max(height >> level, 1u);
 
-		if (!pixels) throw std::runtime_error("Image file not found. Path = " + path);
+		cb.blitImage(
+			image, vk::ImageLayout::eTransferSrcOptimal,
+			image, vk::ImageLayout::eTransferDstOptimal,
+			{
+				vk::ImageBlit{
+					vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level - 1, 0, layerCount },
+					{ vk::Offset3D{ 0, 0, 0 }, vk::Offset3D{ srcWidth, srcHeight, 1 } },
+					vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level, 0, layerCount },
+					{ vk::Offset3D{ 0, 0, 0 }, vk::Offset3D{ dstWidth, dstHeight, 1 } }
+				}
+			},
+			vk::Filter::eLinear
+		);
+	}
 
-		imageSize = width * height * sizeof(uint32_t);
+	if (mipLevels > 1)
+		transitionImageLayout(cb, image, format, vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, layerCount, 0, mipLevels - 1);
+	transitionImageLayout(cb, image, format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, layerCount, mipLevels - 1, 1);
+}
 
-		stagingBuffer = createBufferUnique(imageSize, vk::BufferUsageFlagBits::eTransferSrc, VMA_MEMORY_USAGE_CPU_ONLY);
-		{
-			void* data;
-			vk::Result result{ vmaMapMemory(vkRenderCtx.allocator, stagingBuffer->allocation, &data) };
-			if (result != vk::Result::eSuccess)
-				vk::throwResultException(result, "vmaMapMemory");
+static bool canBlitMipmaps(vk::Format format)
+{
+	auto features = vkRenderCtx.physicalDevice.getFormatProperties(format).optimalTilingFeatures;
+	auto required = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+	return (features & required) == required;
+}
 
-			memcpy(data, pixels.get(), imageSize);
+static bool canSampleFormat(vk::Format format)
+{
+	if (TextureData::IsBlockCompressed(format) && !vkRenderCtx.physicalDevice.getFeatures().textureCompressionBC)
+		return false;
 
-			vmaUnmapMemory(vkRenderCtx.allocator, stagingBuffer->allocation);
-		}
+	auto features = vkRenderCtx.physicalDevice.getFormatProperties(format).optimalTilingFeatures;
+	auto required = vk::FormatFeatureFlagBits::eSampledImage | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+	return (features & required) == required;
+}
+
+void Renderer::prepareTexture(TextureData& texture)
+{
+	if (TextureData::IsBlockCompressed(texture.format()) && !canSampleFormat(texture.format()))
+	{
+		std::cout << "Device can't sample " << vk::to_string(texture.format()) << ", decompressing " << texture.path() << std::endl;
+		texture.decompress();
 	}
 
-	VmaAlloc<vk::Image> image;
+	// Prefer building the chain on the GPU with linear blits, formats without blit support fall back to a CPU box filter.
+	if (texture.levels().size() == 1 && !TextureData::IsBlockCompressed(texture.format()) && !canBlitMipmaps(texture.format()))
+		texture.generateMips();
+}
+
+vk::DeviceSize Renderer::stagingSizeBound(const TextureInfo& info)
+{
+	// prepareTexture can at worst decode to RGBA8 or add a full CPU mip chain, neither is smaller than the file's own levels.
+	uint32_t levels = (info.levels == 1 && !TextureData::IsBlockCompressed(info.format)) ? TextureData::MipLevelCount(info.width, info.height) : info.levels;
+
+	vk::DeviceSize size = stagingAlignment;
+	uint32_t width = info.width, height = info.height;
+	for (uint32_t level = 0; level < levels; ++level)
 	{
-		vk::ImageCreateInfo createInfo{
-			{},
-			vk::ImageType::e2D,
-			vk::Format::eR8G8B8A8Unorm,
-		{ width, height, 1 },
-		1, 1,
-		vk::SampleCountFlagBits::e1,
-		vk::ImageTiling::eOptimal,
-		vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
-		vk::SharingMode::eExclusive, 0, nullptr,
-		vk::ImageLayout::eUndefined
-		};
+		size = align_offset(size, stagingAlignment) + TextureData::LevelSize(vk::Format::eR8G8B8A8Unorm, width, height);
+		width = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	return size;
+}
+
+StagedTexture Renderer::stageTexture(const TextureData& texture, staging_arena& arena)
+{
+	vk::DeviceSize size = 0;
+	for (auto& level : texture.levels())
+		size = align_offset(size, stagingAlignment) + level.size;
 
-		VmaAllocationCreateInfo allocInfo = {};
-		allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	StagedTexture staged{ texture.path(), texture.format(), texture.levels() };
 
-		vk::Result result{ vmaCreateImage(vkRenderCtx.allocator, reinterpret_cast<VkImageCreateInfo*>(&createInfo), &allocInfo, reinterpret_cast<VkImage*>(&image.value), &image.allocation, nullptr) };
+	vk::DeviceSize offset = arena.allocate(size, stagingAlignment);
+	for (auto& level : staged.levels)
+	{
+		offset = align_offset(offset, stagingAlignment);
+		memcpy(arena.data(offset), texture.pixels() + level.offset, level.size);
 
-		if (result != vk::Result::eSuccess)
-			vk::throwResultException(result, "vmaCreateImage");
+		level.offset = static_cast<size_t>(offset);
+		offset += level.size;
 	}
 
-	auto cb = std::move(vkRenderCtx.device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{ vkRenderCtx.commandPool, vk::CommandBufferLevel::ePrimary, 1 })[0]);
+	return staged;
+}
 
-	cb->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+uint32_t Renderer::uploadMipLevels(const StagedTexture& texture)
+{
+	// Textures are uploaded with whatever levels they come with (see prepareTexture), a lone level is expanded with blits.
+	uint32_t uploadLevels = static_cast<uint32_t>(texture.levels.size());
+	if (uploadLevels == 1 && !TextureData::IsBlockCompressed(texture.format))
+		return TextureData::MipLevelCount(texture.levels.front().width, texture.levels.front().height);
+	return uploadLevels;
+}
 
-	transitionImageLayout(*cb, image.value, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
+VmaAlloc<vk::Image> Renderer::allocateTextureImage(vk::Format format, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t layerCount)
+{
+	VmaAlloc<vk::Image> image;
 
-	cb->copyBufferToImage(
-		stagingBuffer->value,
-		image.value,
-		vk::ImageLayout::eTransferDstOptimal,
+	vk::ImageCreateInfo createInfo{
+		{},
+		vk::ImageType::e2D,
+		format,
+	{ width, height, 1 },
+	mipLevels, layerCount,
+	vk::SampleCountFlagBits::e1,
+	vk::ImageTiling::eOptimal,
+	vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+	vk::SharingMode::eExclusive, 0, nullptr,
+	vk::ImageLayout::eUndefined
+	};
+
+	VmaAllocationCreateInfo allocInfo = {};
+	allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	vk::Result result{ vmaCreateImage(vkRenderCtx.allocator, reinterpret_cast<VkImageCreateInfo*>(&createInfo), &allocInfo, reinterpret_cast<VkImage*>(&image.value), &image.allocation, nullptr) };
+
+	if (result != vk::Result::eSuccess)
+		vk::throwResultException(result, "vmaCreateImage");
+
+	return image;
+}
+
+VmaAlloc<vk::Image> Renderer::recordImageUpload(vk::CommandBuffer cb, vk::Buffer stagingBuffer, const std::vector<StagedTexture>& layers)
+{
+	if (layers.empty()) throw std::runtime_error("recordImageUpload called without any image layers.");
+
+	auto& first = layers.front();
+	for (auto& layer : layers)
+	{
+		if (layer.levels.front().width != first.levels.front().width || layer.levels.front().height != first.levels.front().height || layer.format != first.format || layer.levels.size() != first.levels.size())
+			throw std::runtime_error("Image layer does not match array extent. Path = " + layer.path);
+	}
+
+	vk::Format format = first.format;
+	uint32_t width = first.levels.front().width, height = first.levels.front().height;
+	uint32_t layerCount = static_cast<uint32_t>(layers.size());
+
+	uint32_t uploadLevels = static_cast<uint32_t>(first.levels.size());
+	uint32_t mipLevels = uploadMipLevels(first);
+	bool blitMips = mipLevels != uploadLevels;
+
+	std::vector<vk::BufferImageCopy> regions;
+	regions.reserve(layerCount * uploadLevels);
+	for (uint32_t layer = 0; layer < layerCount; ++layer)
+	{
+		for (uint32_t level = 0; level < uploadLevels; ++level)
 		{
-			vk::BufferImageCopy{ 0, 0, 0, vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, 0, 0, 1 },{},{ width, height, 1 } }
+			const TextureLevel& mip = layers[layer].levels[level];
+			regions.push_back(vk::BufferImageCopy{ mip.offset, 0, 0, vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level, layer, 1 },{},{ mip.width, mip.height, 1 } });
 		}
-	);
+	}
 
-	transitionImageLayout(*cb, image.value, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+	VmaAlloc<vk::Image> image = allocateTextureImage(format, width, height, mipLevels, layerCount);
 
-	cb->end();
+	transitionImageLayout(cb, image.value, format, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, layerCount, 0, mipLevels);
 
-	vkRenderCtx.queue.submit({
-		vk::SubmitInfo{ 0, nullptr, nullptr, 1, &cb.get() }
-		}, nullptr);
+	cb.copyBufferToImage(
+		stagingBuffer,
+		image.value,
+		vk::ImageLayout::eTransferDstOptimal,
+		regions
+	);
 
-	vkRenderCtx.queue.waitIdle();
+	if (blitMips)
+		generateMipmaps(cb, image.value, format, width, height, mipLevels, layerCount);
+	else
+		transitionImageLayout(cb, image.value, format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, layerCount, 0, mipLevels);
 
 	return image;
 }
 
-UniqueVmaAlloc<vk::Image> Renderer::createImageUnique(const std::string & path)
+vk::DeviceSize Renderer::stagingSize(const std::vector<TextureData>& layers)
 {
-	return UniqueVmaAlloc<vk::Image>(createImage(path), vkRenderCtx.allocator);
+	vk::DeviceSize size = 0;
+	for (auto& layer : layers)
+	{
+		for (auto& level : layer.levels())
+			size += align_offset(level.size, stagingAlignment);
+	}
+	return size;
 }
 
-static void mouse_move_cb(GLFWwindow* window, double xpos, double ypos)
+VmaAlloc<vk::Image> Renderer::createImage(const std::vector<TextureData>& layers)
 {
-	reinterpret_cast<Renderer*>(glfwGetWindowUserPointer(window))->mouseMoved(xpos, ypos);
-}
+	staging_arena arena(stagingSize(layers));
 
-void Renderer::initWindow()
-{
-	glfwInit();
+	std::vector<StagedTexture> staged;
+	staged.reserve(layers.size());
+	for (auto& layer : layers)
+		staged.push_back(stageTexture(layer, arena));
 
-	glfwWindowHint(GLFW_RESIZABLE, false);
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	auto cb = std::move(vkRenderCtx.device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{ vkRenderCtx.commandPool, vk::CommandBufferLevel::ePrimary, 1 })[0]);
 
-	GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan Test", nullptr, nullptr);
+	cb->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+	VmaAlloc<vk::Image> image = recordImageUpload(*cb, arena.buffer(), staged);
+	cb->end();
 
-	m_window.reset(window);
+	vkRenderCtx.queue.submit({
+		vk::SubmitInfo{ 0, nullptr, nullptr, 1, &cb.get() }
+		}, nullptr);
 
-	glfwSetWindowUserPointer(m_window.get(), this);
+	vkRenderCtx.queue.waitIdle();
 
-	glfwSetInputMode(m_window.get(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-	glfwSetCursorPosCallback(m_window.get(), mouse_move_cb);
+	return image;
+}
 
+UniqueVmaAlloc<vk::Image> Renderer::createImageUnique(const std::vector<TextureData>& layers)
+{
+	return UniqueVmaAlloc<vk::Image>(createImage(layers), vkRenderCtx.allocator);
 }
 
 void Renderer::initCoreRenderer()
@@ -346,6 +593,8 @@ void Renderer::initCoreRenderer()
 	vkRenderCtx.device = *m_device;
 	vkRenderCtx.queueFamily = m_queueFamily;
 	vkRenderCtx.queue = m_queue;
+	vkRenderCtx.computeQueueFamily = m_computeQueueFamily;
+	vkRenderCtx.computeQueue = m_computeQueue;
 
 	initAllocator();
 	vkRenderCtx.allocator = m_allocator.get();
@@ -364,6 +613,9 @@ void Renderer::initCoreRenderer()
 	initCommandPools();
 	vkRenderCtx.commandPool = *m_commandPool;
 
+	initPipelineCache();
+	vkRenderCtx.pipelineCache = *m_pipelineCache;
+
 }
 
 const std::vector<const char*> layers{
@@ -383,6 +635,11 @@ void Renderer::initInstance()
 	};
 	std::copy(glfwExtensions, &glfwExtensions[count], std::back_inserter(extensions));
 
+	// Needed to query descriptor indexing support on a 1.0 instance.
+	m_physicalDeviceProperties2 = hasExtension(vk::enumerateInstanceExtensionProperties(), VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	if (m_physicalDeviceProperties2)
+		extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+
 	std::cout << "Loading Instance Extensions: {";
 	std::copy(extensions.begin(), extensions.end(), std::ostream_iterator<const char*>(std::cout, ", "));
 	std::cout << '}' << std::endl;
@@ -401,7 +658,7 @@ void Renderer::initInstance()
 void Renderer::initSurface()
 {
 	vk::SurfaceKHR surface;
-	auto result = static_cast<vk::Result>(glfwCreateWindowSurface(*m_instance, m_window.get(), nullptr, reinterpret_cast<VkSurfaceKHR*>(&surface)));
+	auto result = static_cast<vk::Result>(glfwCreateWindowSurface(*m_instance, m_window, nullptr, reinterpret_cast<VkSurfaceKHR*>(&surface)));
 
 	vk::ObjectDestroy<vk::Instance,vk::DispatchLoaderStatic> deleter(*m_instance);
 	m_surface = vk::createResultValue<vk::SurfaceKHR,vk::DispatchLoaderStatic>(result, surface, "glfwCreateWindowSurface", deleter);
@@ -462,8 +719,19 @@ void Renderer::initDevice()
 
 	m_queueFamily = static_cast<uint32_t>(std::distance(queueFamilies.begin(), it));
 
+	// Async compute: a family with compute but no graphics runs alongside the graphics queue on most hardware.
+	auto computeIt = std::find_if(queueFamilies.begin(), queueFamilies.end(), [](vk::QueueFamilyProperties family)
+	{
+		return (family.queueFlags & vk::QueueFlagBits::eCompute) && !(family.queueFlags & vk::QueueFlagBits::eGraphics);
+	});
+	m_computeQueueFamily = computeIt != queueFamilies.end() ? static_cast<uint32_t>(std::distance(queueFamilies.begin(), computeIt)) : m_queueFamily;
+
+	std::cout << "Async compute: " << (m_computeQueueFamily != m_queueFamily ? "queue family " + std::to_string(m_computeQueueFamily) : std::string("none, sharing the graphics queue")) << std::endl;
+
 	float priorities[] = { 1.0f }; // Ensure this is has as many numbers as queues.
 	std::vector<vk::DeviceQueueCreateInfo> queues{ vk::DeviceQueueCreateInfo{ {}, m_queueFamily, 1, priorities } };
+	if (m_computeQueueFamily != m_queueFamily)
+		queues.push_back(vk::DeviceQueueCreateInfo{ {}, m_computeQueueFamily, 1, priorities });
 
 	std::vector<const char*> extensions = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME
@@ -472,15 +740,54 @@ void Renderer::initDevice()
 	vk::PhysicalDeviceFeatures features;
 	//features.largePoints = true;
 	features.samplerAnisotropy = true;
+	features.textureCompressionBC = m_physicalDevice.getFeatures().textureCompressionBC;
+
+	vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures;
+	{
+		auto available = m_physicalDevice.enumerateDeviceExtensionProperties();
+
+		if (m_physicalDeviceProperties2
+			&& hasExtension(available, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)
+			&& hasExtension(available, VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+		{
+			vk::PhysicalDeviceDescriptorIndexingFeaturesEXT supported;
+			vk::PhysicalDeviceFeatures2KHR features2;
+			features2.pNext = &supported;
+			vkGetPhysicalDeviceFeatures2KHR(m_physicalDevice, reinterpret_cast<VkPhysicalDeviceFeatures2KHR*>(&features2));
+
+			vk::PhysicalDeviceProperties2KHR properties2;
+			properties2.pNext = &m_descriptorIndexingProperties;
+			vkGetPhysicalDeviceProperties2KHR(m_physicalDevice, reinterpret_cast<VkPhysicalDeviceProperties2KHR*>(&properties2));
+
+			m_descriptorIndexing = supported.runtimeDescriptorArray
+				&& supported.shaderSampledImageArrayNonUniformIndexing
+				&& supported.descriptorBindingPartiallyBound
+				&& supported.descriptorBindingSampledImageUpdateAfterBind;
+		}
+
+		if (m_descriptorIndexing)
+		{
+			extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+			extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+
+			indexingFeatures.runtimeDescriptorArray = true;
+			indexingFeatures.shaderSampledImageArrayNonUniformIndexing = true;
+			indexingFeatures.descriptorBindingPartiallyBound = true;
+			indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = true;
+		}
+	}
+
+	std::cout << "Descriptor indexing: " << (m_descriptorIndexing ? "bindless textures" : "texture arrays") << std::endl;
 
 	m_device = m_physicalDevice.createDeviceUnique(vk::DeviceCreateInfo{ {},
 		static_cast<uint32_t>(queues.size()),	  queues.data(),
 		static_cast<uint32_t>(layers.size()),	  layers.data(),
 		static_cast<uint32_t>(extensions.size()), extensions.data(),
 		&features
-		});
+		}.setPNext(m_descriptorIndexing ? &indexingFeatures : nullptr));
 
 	m_queue = m_device->getQueue(m_queueFamily, 0);
+	m_computeQueue = m_device->getQueue(m_computeQueueFamily, 0);
 
 }
 
@@ -662,42 +969,129 @@ void Renderer::initCommandPools()
 
 }
 
-void Renderer::initPipelineLayout()
+const char* pipelineCachePath = "pipeline_cache.bin";
+
+// Prefixed to the driver's cache data. Vulkan's own header has no driver version, and a driver update can make old data unusable.
+struct PipelineCacheFileHeader
+{
+	uint32_t magic;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t dataSize;
+};
+
+const uint32_t pipelineCacheMagic = 0x4350564B; // "VKPC"
+
+static PipelineCacheFileHeader pipelineCacheHeader(const vk::PhysicalDeviceProperties& properties, uint64_t dataSize)
+{
+	PipelineCacheFileHeader header{ pipelineCacheMagic, properties.vendorID, properties.deviceID, properties.driverVersion, {}, dataSize };
+	memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	return header;
+}
+
+void Renderer::initPipelineCache()
 {
+	std::vector<char> data;
 	{
-		std::vector<vk::DescriptorSetLayoutBinding> bindings{
-			vk::DescriptorSetLayoutBinding{0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment}
-		};
+		std::ifstream file(pipelineCachePath, std::ios::binary | std::ios::ate);
+		if (file)
+		{
+			size_t size = static_cast<size_t>(file.tellg());
+			file.seekg(0);
 
-		std::vector<vk::DescriptorSetLayout> descriptorSetLayout{
-			m_device->createDescriptorSetLayout(
-				vk::DescriptorSetLayoutCreateInfo{
-					{},
-					static_cast<uint32_t>(bindings.size()),
-					bindings.data()
+			PipelineCacheFileHeader expected, header;
+			if (size >= sizeof(header) && file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			{
+				expected = pipelineCacheHeader(vkRenderCtx.physicalDeviceProperties, size - sizeof(header));
+
+				if (memcmp(&header, &expected, sizeof(header)) == 0)
+				{
+					data.resize(size - sizeof(header));
+					if (!file.read(data.data(), data.size()))
+						data.clear();
 				}
-			)
-		};
+				else
+				{
+					std::cout << "Pipeline cache was written by a different device or driver, starting with an empty cache." << std::endl;
+				}
+			}
+		}
+	}
+
+	// Shorter than VkPipelineCacheHeaderVersionOne, the driver would reject it anyway.
+	if (data.size() < 16 + VK_UUID_SIZE)
+		data.clear();
 
-		m_texturePipelineDescriptorSetLayouts = UniqueVector<vk::DescriptorSetLayout>(std::move(descriptorSetLayout), *m_device);
+	m_pipelineCache = m_device->createPipelineCacheUnique(vk::PipelineCacheCreateInfo{ {}, data.size(), data.data() });
 
-		m_texturePipelineLayout = m_device->createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo{ {}, static_cast<uint32_t>(m_texturePipelineDescriptorSetLayouts->size()), m_texturePipelineDescriptorSetLayouts->data() });
+	std::cout << "Pipeline cache: " << (data.empty() ? "cold start" : std::to_string(data.size()) + " bytes loaded") << std::endl;
+}
+
+void Renderer::savePipelineCache()
+{
+	std::vector<uint8_t> data = m_device->getPipelineCacheData(*m_pipelineCache);
+	PipelineCacheFileHeader header = pipelineCacheHeader(vkRenderCtx.physicalDeviceProperties, data.size());
+
+	// Written beside the old cache and renamed over it, so a crash mid write can't leave a truncated cache.
+	std::string tempPath = std::string(pipelineCachePath) + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+		if (!file)
+		{
+			std::cerr << "Failed to write pipeline cache. Path = " << tempPath << std::endl;
+			return;
+		}
 	}
 
+	std::remove(pipelineCachePath);
+	std::rename(tempPath.c_str(), pipelineCachePath);
+}
+
+void Renderer::initPipelineLayout(uint32_t nTextures)
+{
+	// Layouts are reflected from the shaders, so the stages are added here rather than in initPipelines.
 	{
-		std::vector<vk::DescriptorSetLayoutBinding> bindings{
-			vk::DescriptorSetLayoutBinding{ 0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex },
-			vk::DescriptorSetLayoutBinding{ 0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex }
-		};
+		m_texturePipeline.addShaderStage("shaders/texture.vert.spv");
+		m_texturePipeline.addShaderStage(m_textureMode == TextureMode::Bindless ? "shaders/texture_bindless.frag.spv" : "shaders/texture.frag.spv");
 
-		std::vector<vk::DescriptorSetLayout> descriptorSetLayout{
-			m_device->createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{ {}, 1, &bindings[0] }),
-			m_device->createDescriptorSetLayout(vk::DescriptorSetLayoutCreateInfo{ {}, 1, &bindings[1] }),
-		};
+		PipelineInterface textureInterface = m_texturePipeline.reflectInterface();
+
+		if (m_textureMode == TextureMode::Bindless)
+		{
+			DescriptorSetInterface& set = textureInterface.sets.at(0);
+			set.flags = vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT;
+			set.bindings.at(0).descriptorCount = nTextures;
+			set.bindingFlags = { vk::DescriptorBindingFlagBitsEXT::ePartiallyBound | vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind };
+		}
+
+		m_texturePipelineDescriptorSetLayouts = m_pipelineLayouts.getDescriptorSetLayouts(textureInterface);
+		m_texturePipelineLayout = m_pipelineLayouts.getPipelineLayout(textureInterface);
+	}
+
+	{
+		m_worldPipeline.addShaderStage("shaders/world.vert.spv");
+		m_worldPipeline.addShaderStage("shaders/world.frag.spv");
 
-		m_worldPipelineDescriptorSetLayouts = UniqueVector<vk::DescriptorSetLayout>(std::move(descriptorSetLayout), *m_device);
+		PipelineInterface worldInterface = m_worldPipeline.reflectInterface();
 
-		m_worldPipelineLayout = m_device->createPipelineLayoutUnique(vk::PipelineLayoutCreateInfo{ {}, static_cast<uint32_t>(m_worldPipelineDescriptorSetLayouts->size()), m_worldPipelineDescriptorSetLayouts->data() });
+		m_worldPipelineDescriptorSetLayouts = m_pipelineLayouts.getDescriptorSetLayouts(worldInterface);
+		m_worldPipelineLayout = m_pipelineLayouts.getPipelineLayout(worldInterface);
+	}
+
+	{
+		m_particlePipeline.addShaderStage("shaders/particle.vert.spv");
+		m_particlePipeline.addShaderStage("shaders/particle.frag.spv");
+
+		// Set 0 matches the world pipeline's, so the same render data descriptor set is bound.
+		PipelineInterface particleInterface = m_particlePipeline.reflectInterface();
+
+		m_particlePipelineDescriptorSetLayouts = m_pipelineLayouts.getDescriptorSetLayouts(particleInterface);
+		m_particlePipelineLayout = m_pipelineLayouts.getPipelineLayout(particleInterface);
 	}
 }
 
@@ -709,70 +1103,83 @@ void Renderer::initPipelines()
 
 	// Texture (2D) Pipeline
 	{
-		m_texturePipeline.addShaderStage("shaders/texture.vert.spv");
-		m_texturePipeline.addShaderStage("shaders/texture.frag.spv");
-
-		std::vector<vk::VertexInputBindingDescription> bindings{
-			vk::VertexInputBindingDescription{ 0, sizeof(sprite_vertex), vk::VertexInputRate::eVertex},
-			vk::VertexInputBindingDescription{ 1, sizeof(sprite_instance), vk::VertexInputRate::eInstance }
-		};
-		std::vector<vk::VertexInputAttributeDescription> attributes{
-			vk::VertexInputAttributeDescription{ 0, 0, vk::Format::eR32G32Sfloat, 0 },
-			vk::VertexInputAttributeDescription{ 1, 0, vk::Format::eR32G32Sfloat, 8 },
-			vk::VertexInputAttributeDescription{ 2, 1, vk::Format::eR32G32Sfloat, 0 },
-			vk::VertexInputAttributeDescription{ 3, 1, vk::Format::eR32G32Sfloat, 8 }
-		};
-
-		m_texturePipeline.getVertexInputState()
-			.setVertexBindingDescriptionCount(static_cast<uint32_t>(bindings.size()))
-			.setPVertexBindingDescriptions(bindings.data())
-			.setVertexAttributeDescriptionCount(static_cast<uint32_t>(attributes.size()))
-			.setPVertexAttributeDescriptions(attributes.data());
+		m_texturePipeline.setVertexInput(
+			{
+				vk::VertexInputBindingDescription{ 0, sizeof(sprite_vertex), vk::VertexInputRate::eVertex},
+				vk::VertexInputBindingDescription{ 1, sizeof(sprite_instance), vk::VertexInputRate::eInstance }
+			},
+			{
+				vk::VertexInputAttributeDescription{ 0, 0, vk::Format::eR32G32Sfloat, 0 },
+				vk::VertexInputAttributeDescription{ 1, 0, vk::Format::eR32G32Sfloat, 8 },
+				vk::VertexInputAttributeDescription{ 2, 1, vk::Format::eR32G32Sfloat, 0 },
+				vk::VertexInputAttributeDescription{ 3, 1, vk::Format::eR32G32Sfloat, 8 },
+				vk::VertexInputAttributeDescription{ 4, 1, vk::Format::eR32Uint, 16 }
+			});
 		m_texturePipeline.getInputAssemblyState()
 			.setTopology(vk::PrimitiveTopology::eTriangleStrip);
-		m_texturePipeline.getViewportState()
-			.setViewportCount(1)
-			.setPViewports(&viewport)
-			.setScissorCount(1)
-			.setPScissors(&scissor);
-		m_texturePipeline.setLayout(*m_texturePipelineLayout);
+		m_texturePipeline.setViewport(viewport, scissor);
+		m_texturePipeline.setLayout(m_texturePipelineLayout);
 		m_texturePipeline.setRenderPass(*m_renderPass, 0);
 
-		m_texturePipeline.create();
+		// The create info is kept so the pipeline can be rebuilt when its shaders are reloaded.
+		m_texturePipeline.create(m_pipelineRegistry, true);
 	}
 
 	// World (3D) Pipeline
 	{
-		m_worldPipeline.addShaderStage("shaders/world.vert.spv");
-		m_worldPipeline.addShaderStage("shaders/world.frag.spv");
-
-
-		std::vector<vk::VertexInputBindingDescription> bindings{
-			vk::VertexInputBindingDescription{ 0, sizeof(mesh_vertex), vk::VertexInputRate::eVertex }
-		};
-		std::vector<vk::VertexInputAttributeDescription> attributes{
-			vk::VertexInputAttributeDescription{ 0, 0, vk::Format::eR32G32B32Sfloat, 0 },
-			vk::VertexInputAttributeDescription{ 1, 0, vk::Format::eR32G32B32Sfloat, 12 }
-		};
-
-		m_worldPipeline.getVertexInputState()
-			.setVertexBindingDescriptionCount( static_cast<uint32_t>(bindings.size()) )
-			.setPVertexBindingDescriptions(bindings.data())
-			.setVertexAttributeDescriptionCount( static_cast<uint32_t>(attributes.size()) )
-			.setPVertexAttributeDescriptions(attributes.data());
+		m_worldPipeline.setVertexInput(
+			{
+				vk::VertexInputBindingDescription{ 0, sizeof(mesh_vertex), vk::VertexInputRate::eVertex }
+			},
+			{
+				vk::VertexInputAttributeDescription{ 0, 0, vk::Format::eR32G32B32Sfloat, 0 },
+				vk::VertexInputAttributeDescription{ 1, 0, vk::Format::eR32G32B32Sfloat, 12 }
+			});
 		m_worldPipeline.getInputAssemblyState()
 			.setTopology(vk::PrimitiveTopology::eTriangleList);
-		m_worldPipeline.getViewportState()
-			.setViewportCount(1)
-			.setPViewports(&viewport)
-			.setScissorCount(1)
-			.setPScissors(&scissor);
-		m_worldPipeline.setLayout(*m_worldPipelineLayout);
+		m_worldPipeline.setViewport(viewport, scissor);
+		m_worldPipeline.setLayout(m_worldPipelineLayout);
 		m_worldPipeline.setRenderPass(*m_renderPass, 0);
 
-		m_worldPipeline.create();
+		m_worldPipeline.create(m_pipelineRegistry, true);
 	}
 
+	// Particle Pipeline, vertex input straight from the simulation's state buffers.
+	{
+		bool billboards = m_particleDrawMode == ParticleDrawMode::Billboards;
+		vk::VertexInputRate rate = billboards ? vk::VertexInputRate::eInstance : vk::VertexInputRate::eVertex;
+
+		// Positions before and after the last step and velocities are separate arrays, one binding each.
+		m_particlePipeline.setVertexInput(
+			{
+				vk::VertexInputBindingDescription{ 0, sizeof(glm::vec4), rate },
+				vk::VertexInputBindingDescription{ 1, sizeof(glm::vec4), rate },
+				vk::VertexInputBindingDescription{ 2, sizeof(glm::vec4), rate }
+			},
+			{
+				vk::VertexInputAttributeDescription{ 0, 0, vk::Format::eR32G32B32Sfloat, 0 },
+				vk::VertexInputAttributeDescription{ 1, 1, vk::Format::eR32G32B32Sfloat, 0 },
+				vk::VertexInputAttributeDescription{ 2, 2, vk::Format::eR32G32B32Sfloat, 0 }
+			});
+		m_particlePipeline.getInputAssemblyState()
+			.setTopology(billboards ? vk::PrimitiveTopology::eTriangleStrip : vk::PrimitiveTopology::ePointList);
+		m_particlePipeline.getRasterizationState()
+			.setCullMode(vk::CullModeFlagBits::eNone);
+		m_particlePipeline.getColorBlendState()
+			.setPAttachments(&additiveBlendAttachment);
+		m_particlePipeline.specialize(vk::ShaderStageFlagBits::eVertex, "BILLBOARD", billboards);
+		m_particlePipeline.setViewport(viewport, scissor);
+		m_particlePipeline.setLayout(m_particlePipelineLayout);
+		m_particlePipeline.setRenderPass(*m_renderPass, 0);
+
+		m_particlePipeline.create(m_pipelineRegistry, true);
+	}
+
+	m_pipelineRegistry.wait();
+	m_texturePipeline.handle();
+	m_worldPipeline.handle();
+	m_particlePipeline.handle();
+
 }
 
 struct ObjectRenderData
@@ -797,18 +1204,22 @@ void Renderer::initDescriptorSets(size_t nObjects)
 			[](uint32_t sum, const vk::DescriptorPoolSize& poolSize) { return sum + poolSize.descriptorCount; }
 		);
 
-		m_descriptorPool = m_device->createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{ {}, maxSize, static_cast<uint32_t>(poolSizes.size()), poolSizes.data() });
+		vk::DescriptorPoolCreateFlags flags = m_textureMode == TextureMode::Bindless ? vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT : vk::DescriptorPoolCreateFlags{};
+		m_descriptorPool = m_device->createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{ flags, maxSize, static_cast<uint32_t>(poolSizes.size()), poolSizes.data() });
 	}
 
 
 
 	// Image Descriptors
 	{
-		std::vector<vk::DescriptorSetLayout> layouts(m_textureImages->size(), m_texturePipelineDescriptorSetLayouts[0]);
+		// Bindless uses a single set holding every texture, otherwise there is one set per texture array.
+		size_t nSets = m_textureMode == TextureMode::Bindless ? 1 : m_textureImages->size();
+
+		std::vector<vk::DescriptorSetLayout> layouts(nSets, m_texturePipelineDescriptorSetLayouts[0]);
 
 		m_textureSamplerDescriptorSets = m_device->allocateDescriptorSets(vk::DescriptorSetAllocateInfo{
 			*m_descriptorPool,
-			static_cast<uint32_t>(m_textureImages->size()),
+			static_cast<uint32_t>(nSets),
 			layouts.data()
 		});
 	}
@@ -842,17 +1253,38 @@ void Renderer::initDescriptorSets(size_t nObjects)
 
 	for (size_t i = 0; i < m_textureImageViews->size(); ++i)
 	{
-		imageInfos.emplace_back(*m_textureSampler, m_textureImageViews[i], vk::ImageLayout::eShaderReadOnlyOptimal);
+		imageInfos.emplace_back(*m_textureSampler, m_textureImageViews[i] ? m_textureImageViews[i] : *m_placeholderImageView, vk::ImageLayout::eShaderReadOnlyOptimal);
+	}
 
-		writeInfos.push_back(
-			vk::WriteDescriptorSet{
-				m_textureSamplerDescriptorSets[i],
-				0,
-				0,
-				1,
-				vk::DescriptorType::eCombinedImageSampler,
-			}.setPImageInfo(&imageInfos[i])
-		);
+	if (m_textureMode == TextureMode::Bindless)
+	{
+		if (!imageInfos.empty())
+		{
+			writeInfos.push_back(
+				vk::WriteDescriptorSet{
+					m_textureSamplerDescriptorSets[0],
+					0,
+					0,
+					static_cast<uint32_t>(imageInfos.size()),
+					vk::DescriptorType::eCombinedImageSampler,
+				}.setPImageInfo(imageInfos.data())
+			);
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < imageInfos.size(); ++i)
+		{
+			writeInfos.push_back(
+				vk::WriteDescriptorSet{
+					m_textureSamplerDescriptorSets[i],
+					0,
+					0,
+					1,
+					vk::DescriptorType::eCombinedImageSampler,
+				}.setPImageInfo(&imageInfos[i])
+			);
+		}
 	}
 
 	size_t RenderData_size = align_offset(sizeof(RenderData),vkRenderCtx.physicalDeviceProperties.limits.minUniformBufferOffsetAlignment);
@@ -924,11 +1356,11 @@ void Renderer::initBuffers(const std::vector<Sprite>& sceneSprites, const std::v
 
 	std::vector<sprite_instance> instData;
 	instData.reserve(sceneSprites.size());
-	std::transform(sceneSprites.begin(), sceneSprites.end(), std::back_inserter(instData), [](const Sprite& sprite) { return sprite_instance{ sprite.pos, sprite.scale }; });
+	std::transform(sceneSprites.begin(), sceneSprites.end(), std::back_inserter(instData), [this](const Sprite& sprite) { return sprite_instance{ sprite.pos, sprite.scale, m_textureLocations[sprite.textureId].second }; });
 
 	m_spriteData = vertex_buffer<sprite_instance>{instData.size()};
 
-	m_renderData = uniform_buffer<std::pair<glm::mat4,glm::mat4>>(1);
+	m_renderData = uniform_buffer<RenderData>(1);
 
 	std::vector<ObjectRenderData> objectData;
 	std::transform(objects.begin(), objects.end(), std::back_inserter(objectData), [](const Object& object) -> ObjectRenderData { return { glm::translate(glm::mat4(1), object.pos) }; });
@@ -942,30 +1374,31 @@ void Renderer::initBuffers(const std::vector<Sprite>& sceneSprites, const std::v
 
 void Renderer::initTextures(const std::vector<std::string>& textures)
 {
-	{
-		std::vector<VmaAlloc<vk::Image>> images;
-		std::vector<vk::ImageView> imageViews;
+	// Headers are enough to lay out the images and bound the staging memory before anything is decoded.
+	m_texturePaths = textures;
 
-		images.reserve(textures.size());
-		imageViews.reserve(textures.size());
+	std::vector<TextureInfo> infos;
+	infos.reserve(textures.size());
+	for (auto& path : textures)
+		infos.push_back(TextureData::Probe(path));
 
-		for (auto& path : textures)
+	m_imageTextures.clear();
+	if (m_textureMode == TextureMode::Bindless)
+	{
+		// Every texture gets its own image and descriptor array element, sprite_instance::layer is that element's index.
+		m_textureLocations.clear();
+		m_textureLocations.reserve(textures.size());
+
+		for (size_t i = 0; i < textures.size(); ++i)
 		{
-			images.push_back(createImage(path));
-			imageViews.push_back(m_device->createImageView(vk::ImageViewCreateInfo{
-				{},
-				images.back().value,
-				vk::ImageViewType::e2D,
-				vk::Format::eR8G8B8A8Unorm,
-				vk::ComponentMapping{},
-				vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 }
-				}));
+			m_textureLocations.emplace_back(0u, static_cast<uint32_t>(i));
+			m_imageTextures.push_back({ i });
 		}
-
-		m_textureImages = UniqueVector<VmaAlloc<vk::Image>>( std::move(images), *m_allocator );
-		m_textureImageViews = UniqueVector<vk::ImageView>(std::move(imageViews), *m_device);
 	}
-	
+	else
+	{
+		m_imageTextures = groupTextureArrays(infos);
+	}
 
 	m_textureSampler = m_device->createSamplerUnique(vk::SamplerCreateInfo{
 		{},
@@ -976,19 +1409,549 @@ void Renderer::initTextures(const std::vector<std::string>& textures)
 		vk::SamplerAddressMode::eClampToEdge,
 		vk::SamplerAddressMode::eClampToEdge,
 		0.0f,
-		true, 16,
+		true, std::min(16.0f, vkRenderCtx.physicalDeviceProperties.limits.maxSamplerAnisotropy),
 		false, vk::CompareOp::eAlways,
-		0.0f, 0.0f,
+		0.0f, VK_LOD_CLAMP_NONE,
 		vk::BorderColor::eIntOpaqueBlack,
 		false
 	});
 
+	// Descriptors point here until an image is resident. Array layers clamp, so one layer stands in for any array.
+	{
+		std::vector<TextureData> placeholder;
+		placeholder.push_back(TextureData::Solid("placeholder", 128, 128, 128, 255));
+
+		m_placeholderImage = createImageUnique(placeholder);
+		m_placeholderImageView = m_device->createImageViewUnique(vk::ImageViewCreateInfo{
+			{},
+			m_placeholderImage->value,
+			m_textureMode == TextureMode::Bindless ? vk::ImageViewType::e2D : vk::ImageViewType::e2DArray,
+			vk::Format::eR8G8B8A8Unorm,
+			vk::ComponentMapping{},
+			vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 }
+			});
+	}
+
+	m_textureImages = UniqueVector<VmaAlloc<vk::Image>>(std::vector<VmaAlloc<vk::Image>>(m_imageTextures.size()), *m_allocator);
+	m_textureImageViews = UniqueVector<vk::ImageView>(std::vector<vk::ImageView>(m_imageTextures.size()), *m_device);
+
+	m_textureResidency.assign(m_imageTextures.size(), TextureResidency{});
+	for (auto& residency : m_textureResidency)
+		residency.streaming = m_textureStreaming;
+	m_textureBytes = 0;
+
+	if (m_textureBudget == 0)
+	{
+		// Without an explicit budget textures may use up to three quarters of the largest device local heap.
+		auto memoryProperties = m_physicalDevice.getMemoryProperties();
+		for (uint32_t heap = 0; heap < memoryProperties.memoryHeapCount; ++heap)
+		{
+			if (memoryProperties.memoryHeaps[heap].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+				m_textureBudget = std::max(m_textureBudget, memoryProperties.memoryHeaps[heap].size / 4 * 3);
+		}
+	}
+
+	if (m_textureStreaming)
+	{
+		// Images are queued in order so whatever comes first in the scene tends to become resident first.
+		for (size_t image = 0; image < m_imageTextures.size(); ++image)
+		{
+			std::vector<std::string> paths;
+			for (size_t idx : m_imageTextures[image])
+				paths.push_back(textures[idx]);
+
+			m_threadPool.submit([this, image, paths]() { streamImage(image, paths); });
+		}
+		return;
+	}
+
+	vk::DeviceSize stagingSize = 0;
+	for (auto& info : infos)
+		stagingSize += stagingSizeBound(info);
+
+	staging_arena arena(stagingSize);
+
+	// Decode on the worker pool, each texture copies its levels into the shared arena as soon as it is ready.
+	std::vector<std::future<StagedTexture>> staged;
+	staged.reserve(textures.size());
+	for (auto& path : textures)
+	{
+		staged.push_back(m_threadPool.submit([&arena, path]()
+		{
+			TextureData texture = TextureData::Load(path);
+			prepareTexture(texture);
+			return stageTexture(texture, arena);
+		}));
+	}
+
+	// Wait on everything before get() can throw, no task may outlive the arena.
+	for (auto& future : staged)
+		future.wait();
+
+	std::vector<StagedTexture> stagedTextures;
+	stagedTextures.reserve(staged.size());
+	for (auto& future : staged)
+		stagedTextures.push_back(future.get());
+
+	// Every copy, blit and transition goes into one command buffer and a single submission.
+	auto cb = std::move(vkRenderCtx.device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{ vkRenderCtx.commandPool, vk::CommandBufferLevel::ePrimary, 1 })[0]);
+	cb->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+	for (size_t image = 0; image < m_imageTextures.size(); ++image)
+	{
+		std::vector<StagedTexture> layers;
+		layers.reserve(m_imageTextures[image].size());
+		for (size_t idx : m_imageTextures[image])
+			layers.push_back(stagedTextures[idx]);
+
+		VmaAlloc<vk::Image> alloc = recordImageUpload(*cb, arena.buffer(), layers);
+		vk::ImageView view = createTextureImageView(alloc.value, layers.front().format, static_cast<uint32_t>(layers.size()));
+		replaceTextureImage(image, alloc, view, residencyOf(layers));
+	}
+
+	cb->end();
+
+	vkRenderCtx.queue.submit({
+		vk::SubmitInfo{ 0, nullptr, nullptr, 1, &cb.get() }
+		}, nullptr);
+
+	vkRenderCtx.queue.waitIdle();
+
+	releaseRetiredImages();
+}
+
+vk::ImageView Renderer::createTextureImageView(vk::Image image, vk::Format format, uint32_t layerCount)
+{
+	return m_device->createImageView(vk::ImageViewCreateInfo{
+		{},
+		image,
+		m_textureMode == TextureMode::Bindless ? vk::ImageViewType::e2D : vk::ImageViewType::e2DArray,
+		format,
+		vk::ComponentMapping{},
+		vk::ImageSubresourceRange{ vk::ImageAspectFlagBits::eColor, 0, VK_REMAINING_MIP_LEVELS, 0, layerCount }
+		});
+}
+
+std::vector<std::vector<size_t>> Renderer::groupTextureArrays(const std::vector<TextureInfo>& infos)
+{
+	// Textures with the same size, format and mip count are packed as layers of one array image so they can share a descriptor set and a draw call.
+	std::vector<std::vector<size_t>> arrayLayers;
+	std::vector<TextureInfo> arrayInfos;
+
+	m_textureLocations.clear();
+	m_textureLocations.reserve(infos.size());
+
+	uint32_t maxLayers = vkRenderCtx.physicalDeviceProperties.limits.maxImageArrayLayers;
+
+	auto sameLayout = [](const TextureInfo& a, const TextureInfo& b)
+	{
+		return a.width == b.width && a.height == b.height && a.format == b.format && a.levels == b.levels;
+	};
+
+	for (size_t i = 0; i < infos.size(); ++i)
+	{
+		const TextureInfo& info = infos[i];
+
+		size_t arrayIdx = 0;
+		while (arrayIdx < arrayInfos.size() && (!sameLayout(arrayInfos[arrayIdx], info) || arrayLayers[arrayIdx].size() >= maxLayers))
+			++arrayIdx;
+
+		if (arrayIdx == arrayInfos.size())
+		{
+			arrayInfos.push_back(info);
+			arrayLayers.emplace_back();
+		}
+
+		m_textureLocations.emplace_back(static_cast<uint32_t>(arrayIdx), static_cast<uint32_t>(arrayLayers[arrayIdx].size()));
+		arrayLayers[arrayIdx].push_back(i);
+	}
+
+	return arrayLayers;
+}
+
+void Renderer::streamImage(size_t image, std::vector<std::string> paths)
+{
+	if (m_stopStreaming) return;
+
+	try {
+		std::vector<TextureData> textures;
+		textures.reserve(paths.size());
+		for (auto& path : paths)
+		{
+			textures.push_back(TextureData::Load(path));
+			prepareTexture(textures.back());
+		}
+
+		StagedImage staged{ image, std::make_unique<staging_arena>(stagingSize(textures)), {} };
+		for (auto& texture : textures)
+			staged.layers.push_back(stageTexture(texture, *staged.staging));
+
+		std::lock_guard<std::mutex> lock(m_stagedImagesMutex);
+		m_stagedImages.push_back(std::move(staged));
+	}
+	catch (std::runtime_error e)
+	{
+		// The image keeps its placeholder, like a missing texture would if loading were synchronous it is reported but not fatal.
+		std::cerr << e.what() << std::endl;
+	}
+}
+
+void Renderer::updateTextureStreaming()
+{
+	std::vector<size_t> resident;
+
+	for (auto it = m_imageUploads.begin(); it != m_imageUploads.end();)
+	{
+		if (m_device->getFenceStatus(*it->fence) != vk::Result::eSuccess)
+		{
+			++it;
+			continue;
+		}
+
+		for (size_t i = 0; i < it->images.size(); ++i)
+		{
+			size_t image = it->images[i].image;
+			replaceTextureImage(image, it->created[i].release(), it->views[i].release(), residencyOf(it->images[i].layers));
+			resident.push_back(image);
+		}
+
+		it = m_imageUploads.erase(it);
+	}
+
+	if (!resident.empty())
+	{
+		// Descriptors can't change under a frame in flight. Array mode sets aren't update after bind either, so the command buffers that bound them are recorded again.
+		m_device->waitForFences(*m_bufferFences, true, std::numeric_limits<uint64_t>::max());
+
+		for (size_t image : resident)
+			writeTextureDescriptor(image);
+
+		releaseRetiredImages();
+
+		if (m_textureMode == TextureMode::Array)
+			initCommandBuffers(m_sprites, m_objects);
+	}
+
+	std::vector<StagedImage> staged;
+	{
+		std::lock_guard<std::mutex> lock(m_stagedImagesMutex);
+		staged.swap(m_stagedImages);
+	}
+
+	if (staged.empty()) return;
+
+	// Uploads share the graphics queue, they are submitted between frames from this thread rather than from the workers.
+	ImageUpload upload;
+	upload.cb = std::move(vkRenderCtx.device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{ vkRenderCtx.commandPool, vk::CommandBufferLevel::ePrimary, 1 })[0]);
+	upload.cb->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+	for (auto& image : staged)
+	{
+		upload.created.emplace_back(recordImageUpload(*upload.cb, image.staging->buffer(), image.layers), vkRenderCtx.allocator);
+		upload.views.emplace_back(createTextureImageView(upload.created.back()->value, image.layers.front().format, static_cast<uint32_t>(image.layers.size())), *m_device);
+	}
+
+	upload.cb->end();
+
+	upload.fence = m_device->createFenceUnique(vk::FenceCreateInfo{});
+	m_queue.submit({ vk::SubmitInfo{ 0, nullptr, nullptr, 1, &upload.cb.get() } }, *upload.fence);
+
+	upload.images = std::move(staged);
+	m_imageUploads.push_back(std::move(upload));
+}
+
+void Renderer::writeTextureDescriptor(size_t image)
+{
+	vk::DescriptorImageInfo imageInfo{ *m_textureSampler, m_textureImageViews[image] ? m_textureImageViews[image] : *m_placeholderImageView, vk::ImageLayout::eShaderReadOnlyOptimal };
+
+	bool bindless = m_textureMode == TextureMode::Bindless;
+	m_device->updateDescriptorSets({
+		vk::WriteDescriptorSet{
+			m_textureSamplerDescriptorSets[bindless ? 0 : image],
+			0,
+			bindless ? static_cast<uint32_t>(image) : 0,
+			1,
+			vk::DescriptorType::eCombinedImageSampler,
+		}.setPImageInfo(&imageInfo)
+		}, {});
+}
+
+TextureResidency Renderer::residencyOf(const std::vector<StagedTexture>& layers)
+{
+	TextureResidency residency;
+	residency.format = layers.front().format;
+	residency.width = layers.front().levels.front().width;
+	residency.height = layers.front().levels.front().height;
+	residency.mipLevels = uploadMipLevels(layers.front());
+	residency.layers = static_cast<uint32_t>(layers.size());
+	return residency;
+}
+
+void Renderer::setTextureBudget(vk::DeviceSize bytes)
+{
+	m_textureBudget = bytes;
+}
+
+void Renderer::benchmarkParticles(uint32_t steps)
+{
+	if (!m_particles) throw std::runtime_error("Scene has no particles to benchmark.");
+	m_particles->benchmark(steps);
+}
+
+bool Renderer::benchmarkSort(uint32_t count)
+{
+	return RadixSort::Benchmark(count, m_pipelineLayouts, m_pipelineRegistry, m_threadPool);
+}
+
+bool Renderer::validateParticles()
+{
+	if (!m_particles) throw std::runtime_error("Scene has no particles to validate.");
+	return m_particles->validate(m_threadPool);
+}
+
+void Renderer::replaceTextureImage(size_t image, VmaAlloc<vk::Image> alloc, vk::ImageView view, TextureResidency residency)
+{
+	m_retiredImages.emplace_back(m_textureImages[image], m_textureImageViews[image]);
+	m_textureImages[image] = alloc;
+	m_textureImageViews[image] = view;
+
+	VmaAllocationInfo info;
+	vmaGetAllocationInfo(vkRenderCtx.allocator, alloc.allocation, &info);
+	m_textureHeap = m_physicalDevice.getMemoryProperties().memoryTypes[info.memoryType].heapIndex;
+
+	TextureResidency& current = m_textureResidency[image];
+	residency.bytes = info.size;
+	residency.visible = current.visible;
+	residency.streaming = false;
+
+	m_textureBytes = m_textureBytes - current.bytes + residency.bytes;
+	current = residency;
+}
+
+void Renderer::releaseRetiredImages()
+{
+	for (auto& retired : m_retiredImages)
+	{
+		m_device->destroyImageView(retired.second);
+		vmaDestroyImage(vkRenderCtx.allocator, static_cast<VkImage>(retired.first.value), retired.first.allocation);
+	}
+	m_retiredImages.clear();
+}
+
+void Renderer::updateTextureResidency()
+{
+	if (m_currentFrame % residencyCheckInterval != 0)
+		return;
+
+	// Textures share their heap with everything else, so the heap running full counts as pressure too.
+	VmaStats stats;
+	vmaCalculateStats(vkRenderCtx.allocator, &stats);
+
+	vk::DeviceSize heapSize = m_physicalDevice.getMemoryProperties().memoryHeaps[m_textureHeap].size;
+	vk::DeviceSize heapUsed = stats.memoryHeap[m_textureHeap].usedBytes + stats.memoryHeap[m_textureHeap].unusedBytes;
+	vk::DeviceSize heapLimit = heapSize / 10 * 9;
+
+	vk::DeviceSize excess = std::max(
+		m_textureBytes > m_textureBudget ? m_textureBytes - m_textureBudget : 0,
+		heapUsed > heapLimit ? heapUsed - heapLimit : 0);
+
+	if (excess == 0)
+	{
+		m_budgetWarned = false;
+		return;
+	}
+
+	// Only images no visible sprite samples are candidates, largest first so the fewest lose detail.
+	std::vector<size_t> candidates;
+	for (size_t image = 0; image < m_textureResidency.size(); ++image)
+	{
+		const TextureResidency& residency = m_textureResidency[image];
+		if (m_textureImages[image] && !residency.streaming && !residency.visible && residency.mipLevels > 1)
+			candidates.push_back(image);
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](size_t a, size_t b) { return m_textureResidency[a].bytes > m_textureResidency[b].bytes; });
+
+	// Dropping the top level frees about three quarters of an image.
+	std::vector<size_t> evict;
+	vk::DeviceSize freed = 0;
+	for (size_t image : candidates)
+	{
+		if (freed >= excess) break;
+		evict.push_back(image);
+		freed += m_textureResidency[image].bytes / 4 * 3;
+	}
+
+	if (evict.empty())
+	{
+		if (!m_budgetWarned)
+			std::cout << "Texture memory over budget by " << (excess >> 20) << "MiB with nothing left to evict." << std::endl;
+		m_budgetWarned = true;
+		return;
+	}
+
+	evictTopMips(evict);
+}
+
+void Renderer::evictTopMips(const std::vector<size_t>& images)
+{
+	// The old images are moved to transfer layouts to be copied from, no frame may still be sampling them.
+	m_device->waitForFences(*m_bufferFences, true, std::numeric_limits<uint64_t>::max());
+
+	auto cb = std::move(vkRenderCtx.device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{ vkRenderCtx.commandPool, vk::CommandBufferLevel::ePrimary, 1 })[0]);
+	cb->begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+
+	std::vector<std::pair<VmaAlloc<vk::Image>, TextureResidency>> smaller;
+	smaller.reserve(images.size());
+
+	for (size_t image : images)
+	{
+		const TextureResidency& residency = m_textureResidency[image];
+
+		TextureResidency next = residency;
+		next.width = std::max(residency.width / 2, 1u);
+		next.height = std::max(residency.height / 2, 1u);
+		next.mipLevels = residency.mipLevels - 1;
+		next.evictedLevels = residency.evictedLevels + 1;
+
+		VmaAlloc<vk::Image> alloc = allocateTextureImage(next.format, next.width, next.height, next.mipLevels, next.layers);
+		vk::Image old = m_textureImages[image].value;
+
+		// Level n + 1 of the old image becomes level n of the new one, every level below the top is copied rather than read back from disk.
+		std::vector<vk::ImageCopy> regions;
+		for (uint32_t level = 0; level < next.mipLevels; ++level)
+		{
+			regions.push_back(vk::ImageCopy{
+				vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level + 1, 0, next.layers }, {},
+				vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level, 0, next.layers }, {},
+				vk::Extent3D{ std::max(next.width >> level, 1u), std::max(next.height >> level, 1u), 1 }
+				});
+		}
+
+		transitionImageLayout(*cb, old, residency.format, vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eTransferSrcOptimal, next.layers, 1, next.mipLevels);
+		transitionImageLayout(*cb, alloc.value, next.format, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, next.layers, 0, next.mipLevels);
+
+		cb->copyImage(old, vk::ImageLayout::eTransferSrcOptimal, alloc.value, vk::ImageLayout::eTransferDstOptimal, regions);
+
+		transitionImageLayout(*cb, alloc.value, next.format, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, next.layers, 0, next.mipLevels);
+
+		smaller.emplace_back(alloc, next);
+	}
+
+	cb->end();
+
+	auto fence = m_device->createFenceUnique(vk::FenceCreateInfo{});
+	m_queue.submit({ vk::SubmitInfo{ 0, nullptr, nullptr, 1, &cb.get() } }, *fence);
+	m_device->waitForFences({ *fence }, true, std::numeric_limits<uint64_t>::max());
+
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		auto& next = smaller[i];
+		vk::ImageView view = createTextureImageView(next.first.value, next.second.format, next.second.layers);
+		replaceTextureImage(images[i], next.first, view, next.second);
+		writeTextureDescriptor(images[i]);
+	}
+
+	releaseRetiredImages();
+
+	if (m_textureMode == TextureMode::Array)
+		initCommandBuffers(m_sprites, m_objects);
+
+	std::cout << "Evicted top mip of " << images.size() << " textures, " << (m_textureBytes >> 20) << "MiB of " << (m_textureBudget >> 20) << "MiB texture budget in use." << std::endl;
+}
+
+void Renderer::updateShaderReload()
+{
+	std::vector<Pipeline*> pipelines{ &m_texturePipeline, &m_worldPipeline, &m_particlePipeline };
+	std::vector<ComputePipeline*> computePipelines;
+	if (m_particles)
+		computePipelines = m_particles->pipelines();
+
+	// Every changed shader is reloaded before anything is rebuilt, so a pipeline with several changed stages is rebuilt once.
+	std::vector<const Shader*> reloaded;
+	for (auto& path : m_shaderWatcher.poll())
+	{
+		std::shared_ptr<const vk::UniqueShaderModule> old;
+		try {
+			old = Shader::ReloadShader(path);
+		}
+		catch (std::runtime_error e)
+		{
+			// Usually a half written file, the next write triggers another reload.
+			std::cerr << "Shader reload failed: " << e.what() << std::endl;
+			continue;
+		}
+		if (!old) continue;
+
+		m_retiredShaderModules.push_back(std::move(old));
+		reloaded.push_back(&Shader::FetchShader(path));
+		std::cout << "Reloaded " << path << std::endl;
+	}
+
+	auto rebuild = [this, &reloaded](auto* pipeline)
+	{
+		if (std::any_of(reloaded.begin(), reloaded.end(), [pipeline](const Shader* shader) { return pipeline->usesShader(*shader); }))
+			pipeline->rebuild(m_pipelineRegistry);
+	};
+	std::for_each(pipelines.begin(), pipelines.end(), rebuild);
+	std::for_each(computePipelines.begin(), computePipelines.end(), rebuild);
+
+	// Everything is swapped at once, so a shader shared by several pipelines never runs in two versions.
+	bool rebuilt = false;
+	bool ready = true;
+	auto check = [&rebuilt, &ready](auto* pipeline)
+	{
+		rebuilt |= pipeline->rebuilding();
+		ready &= !pipeline->rebuilding() || pipeline->rebuildReady();
+	};
+	std::for_each(pipelines.begin(), pipelines.end(), check);
+	std::for_each(computePipelines.begin(), computePipelines.end(), check);
+
+	// Old modules are only read by compiles, with none running they can go.
+	if (!rebuilt)
+		m_retiredShaderModules.clear();
+	if (!rebuilt || !ready)
+		return;
+
+	// The command buffers are prerecorded with the old pipelines bound, none of them may be in flight.
+	// Batches of particle steps are recorded as they are submitted and pick up the new compute pipelines by themselves.
+	m_device->waitForFences(*m_bufferFences, true, std::numeric_limits<uint64_t>::max());
+	vkRenderCtx.computeQueue.waitIdle();
+
+	std::vector<vk::Pipeline> retired;
+	auto finish = [&retired](auto* pipeline)
+	{
+		if (!pipeline->rebuilding()) return;
+
+		try {
+			vk::Pipeline old = pipeline->finishRebuild();
+			// Unchanged SPIR-V maps to the same module and so the same pipeline.
+			if (old != pipeline->handle())
+				retired.push_back(old);
+		}
+		catch (std::runtime_error e)
+		{
+			std::cerr << "Pipeline rebuild failed: " << e.what() << std::endl;
+		}
+	};
+	std::for_each(pipelines.begin(), pipelines.end(), finish);
+	std::for_each(computePipelines.begin(), computePipelines.end(), finish);
+
+	initCommandBuffers(m_sprites, m_objects);
+
+	for (auto pipeline : retired)
+		m_pipelineRegistry.release(pipeline);
+	m_retiredShaderModules.clear();
 }
 
 void Renderer::initCommandBuffers(const std::vector<Sprite>& sprites, const std::vector<Object>& objects)
 {
+	if (!m_graphicsCommandBuffers.empty())
+		m_device->freeCommandBuffers(*m_commandPool, m_graphicsCommandBuffers);
+
+	// The particle states a frame draws rotate through the ring, so with particles there is a command buffer for each ring position.
+	uint32_t variants = m_particles ? ParticleSimulation::stateCount : 1;
 
-	m_graphicsCommandBuffers = m_device->allocateCommandBuffers(vk::CommandBufferAllocateInfo{ *m_commandPool, vk::CommandBufferLevel::ePrimary, static_cast<uint32_t>(m_swapchainFramebuffers->size()) });
+	m_graphicsCommandBuffers = m_device->allocateCommandBuffers(vk::CommandBufferAllocateInfo{ *m_commandPool, vk::CommandBufferLevel::ePrimary, static_cast<uint32_t>(m_swapchainFramebuffers->size()) * variants });
 
 	for (uint32_t i = 0; i < m_graphicsCommandBuffers.size(); ++i)
 	{
@@ -1001,7 +1964,7 @@ void Renderer::initCommandBuffers(const std::vector<Sprite>& sprites, const std:
 		cb.beginRenderPass(
 			vk::RenderPassBeginInfo{
 				*m_renderPass,
-				m_swapchainFramebuffers[i],
+				m_swapchainFramebuffers[i / variants],
 				vk::Rect2D({}, m_swapchainExtent),
 				1, &clearValue
 			},
@@ -1023,13 +1986,13 @@ void Renderer::initCommandBuffers(const std::vector<Sprite>& sprites, const std:
 
 		while (searchIt != sprites.end())
 		{
-			uint32_t id = searchIt->textureId;
+			uint32_t id = m_textureLocations[searchIt->textureId].first;
 
-			auto endIt = std::find_if_not(searchIt, sprites.end(), [id](const Sprite& sp) { return sp.textureId == id; });
+			auto endIt = std::find_if_not(searchIt, sprites.end(), [this, id](const Sprite& sp) { return m_textureLocations[sp.textureId].first == id; });
 
 			for (auto cb : m_graphicsCommandBuffers)
 			{
-				cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *m_texturePipelineLayout, 0, { m_textureSamplerDescriptorSets[id] }, {});
+				cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_texturePipelineLayout, 0, { m_textureSamplerDescriptorSets[id] }, {});
 				auto count = static_cast<uint32_t>(std::distance(searchIt, endIt));
 				auto offset = static_cast<uint32_t>(std::distance(sprites.begin(), searchIt));
 				cb.draw(4, count, 0, offset);
@@ -1046,20 +2009,38 @@ void Renderer::initCommandBuffers(const std::vector<Sprite>& sprites, const std:
 			m_worldPipeline.bind(cb);
 			m_meshVertices.bind(cb, 0);
 			m_meshIndices.bind(cb);
-			cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *m_worldPipelineLayout, 0, { m_renderDataDescriptorSet }, {});
+			cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_worldPipelineLayout, 0, { m_renderDataDescriptorSet }, {});
 		}
 
 		for (size_t i = 0; i < objects.size(); ++i)
 		{
 			for (auto cb : m_graphicsCommandBuffers)
 			{
-				cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *m_worldPipelineLayout, 1, { m_meshDataDescriptorSets[i] }, {});
+				cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_worldPipelineLayout, 1, { m_meshDataDescriptorSets[i] }, {});
 				cb.drawIndexed(m_meshLocations[objects[i].meshId].second, 1, m_meshLocations[objects[i].meshId].first, 0, 0);
 			}
 		}
 
 	}
 
+	if (m_particles)
+	{
+		for (uint32_t i = 0; i < m_graphicsCommandBuffers.size(); ++i)
+		{
+			auto cb = m_graphicsCommandBuffers[i];
+
+			m_particlePipeline.bind(cb);
+			uint32_t slot = i % variants;
+			cb.bindVertexBuffers(0, { m_particles->drawPreviousPositionBuffer(slot), m_particles->drawPositionBuffer(slot), m_particles->drawVelocityBuffer(slot) }, { 0, 0, 0 });
+			cb.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_particlePipelineLayout, 0, { m_renderDataDescriptorSet }, {});
+
+			if (m_particleDrawMode == ParticleDrawMode::Billboards)
+				cb.draw(4, m_particles->count(), 0, 0);
+			else
+				cb.draw(m_particles->count(), 1, 0, 0);
+		}
+	}
+
 	for (auto cb : m_graphicsCommandBuffers)
 	{
 		cb.endRenderPass();
@@ -1071,22 +2052,43 @@ void Renderer::initCommandBuffers(const std::vector<Sprite>& sprites, const std:
 
 const float speed = 50.0f;
 
+bool Renderer::processCommands()
+{
+	RenderCommand command;
+	while (m_commands.tryPop(command))
+	{
+		switch (command.type)
+		{
+		case RenderCommand::Type::Look:
+			mouseMoved(command.cursor.x, command.cursor.y);
+			break;
+		case RenderCommand::Type::Move:
+			m_moveKeys = command.moveKeys;
+			break;
+		case RenderCommand::Type::Quit:
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void Renderer::updateBuffers(float deltaT)
 {
 	glm::vec3 moveDir{ 0.0f };
-	if (glfwGetKey(m_window.get(), GLFW_KEY_W) == GLFW_PRESS)
+	if (m_moveKeys & RenderCommand::Forward)
 	{
 		moveDir += m_camDir;
 	}
-	if (glfwGetKey(m_window.get(), GLFW_KEY_S) == GLFW_PRESS)
+	if (m_moveKeys & RenderCommand::Back)
 	{
 		moveDir -= m_camDir;
 	}
-	if (glfwGetKey(m_window.get(), GLFW_KEY_A) == GLFW_PRESS)
+	if (m_moveKeys & RenderCommand::Left)
 	{
 		moveDir -= glm::cross(VECTOR_UP, m_camDir);
 	}
-	if (glfwGetKey(m_window.get(), GLFW_KEY_D) == GLFW_PRESS)
+	if (m_moveKeys & RenderCommand::Right)
 	{
 		moveDir += glm::cross(VECTOR_UP, m_camDir);
 	}
@@ -1096,17 +2098,10 @@ void Renderer::updateBuffers(float deltaT)
 		m_camPos += glm::normalize(moveDir) * speed * deltaT;
 	}
 
-	if (glfwGetKey(m_window.get(), GLFW_KEY_ESCAPE) == GLFW_PRESS)
-	{
-		glfwSetWindowShouldClose(m_window.get(), GLFW_TRUE);
-	}
-
 	m_cameraRenderData.view = glm::lookAt(m_camPos, m_camPos+m_camDir, VECTOR_UP);
-
-	buffer::updateBuffers(*m_instanceDataBuffer, {&m_renderData}, {&m_cameraRenderData});
 }
 
-void Renderer::renderFrame()
+void Renderer::renderFrame(uint32_t simulationSteps)
 {
 	uint32_t imageIdx = 0;
 
@@ -1116,13 +2111,35 @@ void Renderer::renderFrame()
 	m_device->waitForFences({m_bufferFences[idx]}, true, std::numeric_limits<uint64_t>::max());
 	m_device->resetFences({m_bufferFences[idx]});
 
-	vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+	std::vector<vk::Semaphore> waitSemaphores{ m_imageAvailableSemaphores[imageIdx] };
+	std::vector<vk::PipelineStageFlags> waitStages{ vk::PipelineStageFlagBits::eColorAttachmentOutput };
+	std::vector<vk::Semaphore> signalSemaphores{ m_renderFinishedSemaphores[idx] };
+
+	// This frame's steps simulate on the compute queue while it draws what the previous frame's steps left.
+	if (m_particles)
+	{
+		m_particles->submitSteps(simulationSteps, m_simulationTimestep.interpolation());
+		m_cameraRenderData.particleInterpolation = m_particles->renderInterpolation();
+
+		if (vk::Semaphore stepFinished = m_particles->renderWaitSemaphore())
+		{
+			waitSemaphores.push_back(stepFinished);
+			waitStages.push_back(vk::PipelineStageFlagBits::eVertexInput);
+		}
+		signalSemaphores.push_back(m_particles->renderSignalSemaphore());
+	}
+
+	// Written here rather than in updateBuffers(), once the particle interpolation of the drawn slot is known.
+	buffer::updateBuffers(*m_instanceDataBuffer, {&m_renderData}, {&m_cameraRenderData});
+
+	// Recorded per particle draw slot after the swapchain image.
+	size_t cbIdx = m_particles ? idx * ParticleSimulation::stateCount + m_particles->renderSlot() : idx;
 
 	m_queue.submit({
 		vk::SubmitInfo{
-			1, &m_imageAvailableSemaphores[imageIdx], &waitStage,
-			1, &m_graphicsCommandBuffers[idx],
-			1, &m_renderFinishedSemaphores[idx]
+			static_cast<uint32_t>(waitSemaphores.size()), waitSemaphores.data(), waitStages.data(),
+			1, &m_graphicsCommandBuffers[cbIdx],
+			static_cast<uint32_t>(signalSemaphores.size()), signalSemaphores.data()
 		}
 		}, m_bufferFences[idx]);
 
@@ -7,6 +7,7 @@
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan.hpp>
 #include <vk_mem_alloc.h>
+#include <functional>
 #include "globals.h"
 #include "pipeline.h"
 
@@ -27,37 +28,102 @@ struct RenderData
 {
 	glm::mat4 projection;
 	glm::mat4 view;
+	float particleInterpolation = 0.0f; // Between the last two simulation steps the particles are drawn at.
 };
 
 const uint32_t WIDTH = 800, HEIGHT = 600;
 
 #include "scene.h"
 #include "mesh.h"
+#include "particles.h"
+#include "fixed_timestep.h"
+#include "radix_sort.h"
 #include "shader.h"
+#include "shader_watcher.h"
 #include "buffer.h"
+#include "texture.h"
+#include "thread_pool.h"
+#include "window.h"
 
 
 using sometype = vertex_buffer<sprite_vertex>;
 
+enum class TextureMode
+{
+	Array,		// Same sized textures share an array image, one bind and draw per array.
+	Bindless	// Every texture is an element of one descriptor array indexed per instance (VK_EXT_descriptor_indexing).
+};
+
+enum class ParticleDrawMode
+{
+	Billboards,	// A camera facing quad per particle, drawn instanced.
+	Points		// One pixel per particle, for counts where quads cost too much fill rate.
+};
+
+// A prepared texture whose levels have been copied into a staging buffer, level offsets are relative to that buffer.
+struct StagedTexture
+{
+	std::string path;
+	vk::Format format;
+	std::vector<TextureLevel> levels;
+};
+
+// Memory bookkeeping for one of the renderer's texture images.
+struct TextureResidency
+{
+	vk::Format format = vk::Format::eUndefined;
+	uint32_t width = 0, height = 0; // Of the resident top level.
+	uint32_t mipLevels = 0;
+	uint32_t layers = 0;
+	uint32_t evictedLevels = 0; // Top levels dropped under memory pressure.
+	vk::DeviceSize bytes = 0;
+	bool visible = false; // Sampled by a sprite that is at least partly on screen, such images are never evicted.
+	bool streaming = false;
+};
+
 class Renderer
 {
 public:
+	~Renderer();
 
-	void init();
+	// Renders into the window, which has to outlive the renderer.
+	void init(const Window& window);
 	void loadScene(const Scene& scene);
+	// Renders frames until a Quit command arrives, on a thread of its own with the window's events handled on the main thread.
 	void loop();
 
+	// Where the window thread puts input, taken off once per frame.
+	RenderCommandQueue& commands()
+	{
+		return m_commands;
+	}
+
 
 	void mouseMoved(float x, float y);
 
+	// Texture memory the residency manager keeps within by evicting mips of textures nothing on screen samples, 0 picks a share of device local memory.
+	void setTextureBudget(vk::DeviceSize bytes);
+
+	// Times steps of the loaded scene's particle simulation and prints the throughput, the state they leave is kept.
+	void benchmarkParticles(uint32_t steps);
+	// Checks a GPU step of the loaded scene's particles against the CPU reference, returns whether they agree.
+	bool validateParticles();
+	// Runs RadixSort::Benchmark over count keys, returns whether the GPU and CPU sorts agree.
+	bool benchmarkSort(uint32_t count);
+
 #pragma region Utils
 
-	static VmaAlloc<vk::Buffer> createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaMemoryUsage memUsage);
-	static UniqueVmaAlloc<vk::Buffer> createBufferUnique(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaMemoryUsage memUsage);
+	// Shared buffers are used by the graphics and compute queues without ownership transfers.
+	static VmaAlloc<vk::Buffer> createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaMemoryUsage memUsage, bool shared = false);
+	static UniqueVmaAlloc<vk::Buffer> createBufferUnique(vk::DeviceSize size, vk::BufferUsageFlags usage, VmaMemoryUsage memUsage, bool shared = false);
 
 	static void copyBuffer(VmaAlloc<vk::Buffer> src, VmaAlloc<vk::Buffer> dst);
 	static void copyBuffer(VmaAlloc<vk::Buffer> src, VmaAlloc<vk::Buffer> dst, const std::vector<vk::BufferCopy>& ranges);
 
+	// Records commands, runs them on the graphics queue and waits. Returns their GPU time in seconds from timestamps,
+	// or the wall time of the submission on queues without timestamps.
+	static double timeCommands(const std::function<void(vk::CommandBuffer)>& record);
+
 	template<typename Vertex>
 	static VmaAlloc<vk::Buffer> createVertexBuffer(const std::vector<std::vector<Vertex>>& meshes, std::vector<std::pair<uint32_t, uint32_t>>& output);
 
@@ -67,8 +133,26 @@ public:
 		return UniqueVmaAlloc<vk::Buffer>{ createVertexBuffer(meshes, output), vkRenderCtx.allocator };
 	}
 
-	static VmaAlloc<vk::Image> createImage(const std::string& path);
-	static UniqueVmaAlloc<vk::Image> createImageUnique(const std::string& path);
+	// Converts a loaded texture into something the device can sample (decompressing or generating mips on the CPU as needed).
+	static void prepareTexture(TextureData& texture);
+
+	// BufferImageCopy offsets must be a multiple of 4 and of the texel block size, 16 covers every format TextureData loads.
+	static const vk::DeviceSize stagingAlignment = 16;
+
+	// Upper bound of the staging memory a texture can need once prepared.
+	static vk::DeviceSize stagingSizeBound(const TextureInfo& info);
+	// Copies every level into the arena, safe to call from several threads at once.
+	static StagedTexture stageTexture(const TextureData& texture, staging_arena& arena);
+	// Levels the image will have once uploaded, counting any generated by blits.
+	static uint32_t uploadMipLevels(const StagedTexture& texture);
+	static VmaAlloc<vk::Image> allocateTextureImage(vk::Format format, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t layerCount);
+	// Creates the image and records its copies, mip generation and transition to shader read, the staging buffer must outlive cb.
+	static VmaAlloc<vk::Image> recordImageUpload(vk::CommandBuffer cb, vk::Buffer stagingBuffer, const std::vector<StagedTexture>& layers);
+
+	static vk::DeviceSize stagingSize(const std::vector<TextureData>& layers);
+
+	static VmaAlloc<vk::Image> createImage(const std::vector<TextureData>& layers);
+	static UniqueVmaAlloc<vk::Image> createImageUnique(const std::vector<TextureData>& layers);
 
 
 #pragma endregion
@@ -77,7 +161,6 @@ public:
 
 private:
 
-	void initWindow();
 
 	// Instance, Surface, DebugReportCallback, etc, all objects that will be alive for duration of app, without prior knowledge of scene.
 #pragma region CoreRenderer
@@ -98,29 +181,70 @@ private:
 	void initFrameBuffers();
 
 	void initCommandPools();
+
+	// Loaded from disk when it was written by the same device and driver, saved again when the render loop exits.
+	void initPipelineCache();
+	void savePipelineCache();
 #pragma endregion
 
 #pragma region SceneLoad
 
 	void initBuffers(const std::vector<Sprite>& sceneSprites, const std::vector<std::string>& objFiles, const std::vector<Object>& objects);
 	void initTextures(const std::vector<std::string>& textures);
-	void initPipelineLayout();
+	std::vector<std::vector<size_t>> groupTextureArrays(const std::vector<TextureInfo>& infos);
+	vk::ImageView createTextureImageView(vk::Image image, vk::Format format, uint32_t layerCount);
+	void initPipelineLayout(uint32_t nTextures);
 	void initPipelines();
 	void initDescriptorSets(size_t nObjects);
 	void initCommandBuffers(const std::vector<Sprite>& sprites, const std::vector<Object>& objects);
 
 #pragma endregion
 
+#pragma region TextureStreaming
+
+	// Runs on a worker: decodes one image's layers into its own staging buffer and queues it for upload.
+	void streamImage(size_t image, std::vector<std::string> paths);
+	// Called between frames: submits staged uploads and swaps finished images in for their placeholder.
+	void updateTextureStreaming();
+	void writeTextureDescriptor(size_t image);
+
+#pragma endregion
+
+#pragma region TextureResidency
+
+	static TextureResidency residencyOf(const std::vector<StagedTexture>& layers);
+
+	// Swaps in a new image and view, the old ones are kept until releaseRetiredImages since a frame may still use them.
+	void replaceTextureImage(size_t image, VmaAlloc<vk::Image> alloc, vk::ImageView view, TextureResidency residency);
+	void releaseRetiredImages();
+
+	// Called between frames: under memory pressure drops the top mips of images no visible sprite samples.
+	void updateTextureResidency();
+	void evictTopMips(const std::vector<size_t>& images);
+
+#pragma endregion
+
+#pragma region ShaderReload
+
+	// Called between frames: reloads changed shaders, rebuilds the pipelines using them in the background and swaps in the finished ones.
+	void updateShaderReload();
+
+#pragma endregion
+
 #pragma region RenderLoop
 
+	// Applies the commands the window thread pushed since the last frame, false once it has asked to quit.
+	bool processCommands();
 	void updateBuffers(float deltaT);
-	void renderFrame();
+	void renderFrame(uint32_t simulationSteps);
 
 #pragma endregion
 
 private:
 
-	std::unique_ptr<GLFWwindow, void(*)(GLFWwindow*)> m_window{nullptr, glfwDestroyWindow};
+	GLFWwindow* m_window = nullptr; // Owned by the Window on the main thread, only used to create the surface.
+	RenderCommandQueue m_commands;
+	uint32_t m_moveKeys = 0; // RenderCommand::MoveKey bits held down.
 
 	vk::UniqueInstance m_instance;
 	vk::UniqueSurfaceKHR m_surface;
@@ -128,11 +252,18 @@ private:
 
 	vk::PhysicalDevice m_physicalDevice;
 
+	bool m_physicalDeviceProperties2 = false;
+	bool m_descriptorIndexing = false;
+	vk::PhysicalDeviceDescriptorIndexingPropertiesEXT m_descriptorIndexingProperties;
+
 	vk::UniqueDevice m_device;
 
 	uint32_t m_queueFamily;
 	vk::Queue m_queue;
 
+	uint32_t m_computeQueueFamily;
+	vk::Queue m_computeQueue;
+
 	vk::UniqueSwapchainKHR m_swapchain;
 	vk::Format m_swapchainFormat;
 	vk::Extent2D m_swapchainExtent;
@@ -145,6 +276,10 @@ private:
 
 	vk::UniqueCommandPool m_commandPool;
 
+	vk::UniquePipelineCache m_pipelineCache;
+	PipelineRegistry m_pipelineRegistry{ m_threadPool };
+	PipelineLayoutCache m_pipelineLayouts;
+
 	UniqueVmaAllocator m_allocator;
 
 	UniqueVector<vk::Semaphore> m_imageAvailableSemaphores;
@@ -153,14 +288,19 @@ private:
 
 	ShaderFree _sf;
 
-	UniqueVector<vk::DescriptorSetLayout> m_texturePipelineDescriptorSetLayouts;
-	vk::UniquePipelineLayout m_texturePipelineLayout;
+	std::vector<vk::DescriptorSetLayout> m_texturePipelineDescriptorSetLayouts;
+	vk::PipelineLayout m_texturePipelineLayout;
 	Pipeline m_texturePipeline{ GraphicsPipelineDefaults() };
 
-	UniqueVector<vk::DescriptorSetLayout> m_worldPipelineDescriptorSetLayouts;
-	vk::UniquePipelineLayout m_worldPipelineLayout;
+	std::vector<vk::DescriptorSetLayout> m_worldPipelineDescriptorSetLayouts;
+	vk::PipelineLayout m_worldPipelineLayout;
 	Pipeline m_worldPipeline{ GraphicsPipelineDefaults() };
 
+	std::vector<vk::DescriptorSetLayout> m_particlePipelineDescriptorSetLayouts;
+	vk::PipelineLayout m_particlePipelineLayout;
+	Pipeline m_particlePipeline{ GraphicsPipelineDefaults() };
+	ParticleDrawMode m_particleDrawMode = ParticleDrawMode::Billboards;
+
 	vertex_buffer<sprite_vertex> m_quadVertices;
 	vertex_buffer<mesh_vertex> m_meshVertices;
 	index_buffer<uint16_t> m_meshIndices;
@@ -169,20 +309,70 @@ private:
 
 
 	vertex_buffer<sprite_instance> m_spriteData{ 0 };
-	uniform_buffer<std::pair<glm::mat4,glm::mat4>> m_renderData;
+	uniform_buffer<RenderData> m_renderData;
 	uniform_buffer<glm::mat4> m_objectData;
 	UniqueVmaAlloc<vk::Buffer> m_instanceDataBuffer;
 
 	vk::UniqueDescriptorPool m_descriptorPool;
 
-	std::vector<vk::CommandBuffer> m_graphicsCommandBuffers;
+	std::vector<vk::CommandBuffer> m_graphicsCommandBuffers; // Per swapchain image, and per particle state buffer when there are particles.
 
 	UniqueVector<VmaAlloc<vk::Image>> m_textureImages;
 	UniqueVector<vk::ImageView> m_textureImageViews;
 	vk::UniqueSampler m_textureSampler;
 
+	TextureMode m_textureMode = TextureMode::Array;
+	std::vector<std::pair<uint32_t,uint32_t>> m_textureLocations; // (array, layer) of each scene texture, layer is the descriptor index when bindless.
+
 	std::vector<std::pair<uint32_t,uint32_t>> m_meshLocations;
 
+	std::vector<Sprite> m_sprites; // Sorted by texture array, kept so the command buffers can be recorded again.
+	std::vector<Object> m_objects;
+
+	bool m_textureStreaming = true;
+	std::vector<std::vector<size_t>> m_imageTextures; // Scene textures held by each of m_textureImages, in layer order.
+
+	UniqueVmaAlloc<vk::Image> m_placeholderImage;
+	vk::UniqueImageView m_placeholderImageView;
+
+	struct StagedImage
+	{
+		size_t image;
+		std::unique_ptr<staging_arena> staging;
+		std::vector<StagedTexture> layers;
+	};
+
+	struct ImageUpload
+	{
+		vk::UniqueFence fence;
+		vk::UniqueCommandBuffer cb;
+		std::vector<StagedImage> images;
+		std::vector<UniqueVmaAlloc<vk::Image>> created;
+		std::vector<vk::UniqueImageView> views;
+	};
+
+	std::mutex m_stagedImagesMutex;
+	std::vector<StagedImage> m_stagedImages;
+	std::vector<ImageUpload> m_imageUploads;
+	std::atomic<bool> m_stopStreaming{ false };
+
+	static const uint64_t residencyCheckInterval = 30; // Frames between memory pressure checks, vmaCalculateStats walks every block.
+
+	std::vector<std::string> m_texturePaths;
+	std::vector<TextureResidency> m_textureResidency;
+
+	ShaderWatcher m_shaderWatcher{ "shaders" };
+	std::vector<std::shared_ptr<const vk::UniqueShaderModule>> m_retiredShaderModules;
+
+	std::unique_ptr<ParticleSimulation> m_particles;
+	// Sixty steps per second of simulated time, whatever the frame rate, with at most four per frame.
+	FixedTimestep m_simulationTimestep{ 1.0 / 60.0, 4 };
+	std::vector<std::pair<VmaAlloc<vk::Image>, vk::ImageView>> m_retiredImages;
+	vk::DeviceSize m_textureBytes = 0;
+	vk::DeviceSize m_textureBudget = 0;
+	uint32_t m_textureHeap = 0;
+	bool m_budgetWarned = false;
+
 	std::vector<vk::DescriptorSet> m_meshDataDescriptorSets;
 	vk::DescriptorSet m_renderDataDescriptorSet;
 
@@ -195,6 +385,9 @@ private:
 
 	size_t m_currentFrame = 0;
 
+	// Last, so its workers are joined before anything a task touches is destroyed.
+	ThreadPool m_threadPool;
+
 };
 
 template<typename Vertex>
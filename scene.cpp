@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "scene.h"
 
+#include <sstream>
+
 
 Scene Scene::Load(const std::string & path)
 {
@@ -10,8 +12,13 @@ Scene Scene::Load(const std::string & path)
 	
 	if(!inFile) throw std::runtime_error("Scene file not found. Path = " + path);
 
-	unsigned int nSprites, nObjects;
-	inFile >> nSprites >> nObjects; inFile.ignore();
+	// Header: sprite count, object count, then optionally a particle count and the solver to simulate them with.
+	std::string header;
+	std::getline(inFile, header);
+
+	unsigned int nSprites = 0, nObjects = 0;
+	std::istringstream headerStream(header);
+	headerStream >> nSprites >> nObjects >> scene.m_particleCount >> scene.m_particleSolver;
 
 	scene.m_sprites.reserve(nSprites);
 	scene.m_objects.reserve(nObjects);
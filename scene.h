@@ -18,6 +18,7 @@ struct sprite_instance
 {
 	glm::vec2 pos;
 	glm::vec2 scale;
+	uint32_t layer; // Texture array layer, or descriptor array index in bindless mode.
 };
 
 struct Sprite
@@ -62,6 +63,16 @@ public:
 		return m_objects;
 	}
 
+	uint32_t particleCount() const
+	{
+		return m_particleCount;
+	}
+	// As named in the scene file, empty to leave the choice to the simulation.
+	const std::string& particleSolver() const
+	{
+		return m_particleSolver;
+	}
+
 private:
 
 	std::vector<std::string> m_textures;
@@ -70,5 +81,8 @@ private:
 	std::vector<std::string> m_objFiles;
 	std::vector<Object> m_objects;
 
+	uint32_t m_particleCount = 0;
+	std::string m_particleSolver;
+
 };
 #endif
@@ -1,41 +1,117 @@
 #include "stdafx.h"
 #include "shader.h"
-#include <fstream>
-#include <sstream>
+#include <cstring>
+#include <mutex>
 #include <unordered_map>
 #include "renderer.h"
 
 
+std::mutex shadersMutex;
 std::unordered_map<std::string, Shader> shaders;
 
-const Shader& Shader::FetchShader(const std::string& path)
+// The code is kept so a hash collision can't hand out the wrong module.
+struct CachedModule
 {
-	auto it = shaders.find(path);
+	std::vector<uint8_t> code;
+	std::weak_ptr<const vk::UniqueShaderModule> module;
+};
+
+std::mutex modulesMutex;
+std::unordered_map<uint64_t, std::vector<CachedModule>> modules;
 
-	if (it == shaders.end()) // If not found add it and set it.
-		it = shaders.emplace(path, Shader(path)).first;
+const Shader& Shader::FetchShader(const std::string& path)
+{
+	{
+		std::lock_guard<std::mutex> lock(shadersMutex);
+		auto it = shaders.find(path);
+		if (it != shaders.end())
+			return it->second;
+	}
+
+	// Loaded without the lock so threads fetching different shaders don't wait on each other.
+	// If two threads load the same path the first one in wins and the other copy is dropped.
+	Shader shader(path);
+
+	std::lock_guard<std::mutex> lock(shadersMutex);
+	return shaders.emplace(path, std::move(shader)).first->second;
+}
 
-	return it->second;
+std::shared_ptr<const vk::UniqueShaderModule> Shader::ReloadShader(const std::string& path)
+{
+	{
+		std::lock_guard<std::mutex> lock(shadersMutex);
+		if (shaders.find(path) == shaders.end())
+			return nullptr;
+	}
+
+	// Loaded first, so a file that fails to load leaves the old shader in place.
+	Shader shader(path);
+
+	std::lock_guard<std::mutex> lock(shadersMutex);
+	Shader& loaded = shaders.at(path);
+	std::shared_ptr<const vk::UniqueShaderModule> old = loaded.m_module;
+	loaded = std::move(shader);
+	return old;
 }
 
 void Shader::FreeShaders()
 {
+	std::lock_guard<std::mutex> lock(shadersMutex);
 	shaders.clear();
 }
 
-std::string Shader::getCode() const
+// 64-bit FNV-1a over the SPIR-V bytes.
+static uint64_t hashCode(const MappedFile& code)
 {
-	std::ifstream file(m_path, std::ios::binary);
-
-	std::ostringstream os;
-	os << file.rdbuf();
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < code.size(); ++i)
+	{
+		hash ^= code.data()[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
 
-	return os.str();
+std::shared_ptr<const vk::UniqueShaderModule> Shader::FetchModule(const MappedFile& code)
+{
+	if (code.size() % sizeof(uint32_t) != 0) throw std::runtime_error("Shader code is not a whole number of words. Path = " + code.path());
+
+	uint64_t hash = hashCode(code);
+
+	std::lock_guard<std::mutex> lock(modulesMutex);
+
+	// Entries whose module is gone are dropped on the way, so reloads don't pile up old code.
+	for (auto it = modules.begin(); it != modules.end();)
+	{
+		auto& entries = it->second;
+		entries.erase(std::remove_if(entries.begin(), entries.end(), [](const CachedModule& cached) { return cached.module.expired(); }), entries.end());
+		it = entries.empty() ? modules.erase(it) : std::next(it);
+	}
+
+	auto& bucket = modules[hash];
+
+	for (auto& cached : bucket)
+	{
+		if (cached.code.size() != code.size() || std::memcmp(cached.code.data(), code.data(), code.size()) != 0)
+			continue;
+		if (auto module = cached.module.lock())
+			return module;
+	}
+
+	auto module = std::make_shared<const vk::UniqueShaderModule>(vkRenderCtx.device.createShaderModuleUnique(
+		vk::ShaderModuleCreateInfo{ {}, code.size(), reinterpret_cast<const uint32_t*>(code.data()) }
+	));
+	bucket.push_back(CachedModule{ std::vector<uint8_t>(code.data(), code.data() + code.size()), module });
+	return module;
 }
 
 
 vk::ShaderStageFlagBits Shader::getStage() const
 {
+	if (m_reflection.entryPoints().size() == 1)
+		return m_reflection.entryPoints().front().stage;
+
+	// Modules with several entry points are told apart by the extension.
 	auto lastDot = std::find(m_path.rbegin(), m_path.rend(), '.');
 	auto nextDot = std::find(std::next(lastDot), m_path.rend(), '.');
 
@@ -53,32 +129,84 @@ vk::ShaderStageFlagBits Shader::getStage() const
 
 const char* Shader::findEntryPoint() const
 {
-	// In future we might inspect spirv code.
-	return "main";
+	auto entryPoint = m_reflection.findEntryPoint(getStage());
+	if (!entryPoint) throw std::runtime_error("Shader has no entry point for its stage. Path = " + m_path);
+
+	return entryPoint->name.c_str();
 }
 
 Shader::Shader(std::string path) :
-	m_path(std::move(path)),
-	m_code(getCode()),
-	m_handle(vkRenderCtx.device.createShaderModule(vk::ShaderModuleCreateInfo{ {}, m_code.size(), reinterpret_cast<uint32_t*>(m_code.data()) }))
+	Shader(MappedFile::Open(std::move(path)))
+{
+}
+
+// The mapping is only needed while the module is created, only the module cache keeps a copy of the code.
+Shader::Shader(const MappedFile& code) :
+	m_path(code.path()),
+	m_reflection(ShaderReflection::Reflect(reinterpret_cast<const uint32_t*>(code.data()), code.size() / sizeof(uint32_t), m_path)),
+	m_module(FetchModule(code))
+{
+}
+
+vk::PipelineShaderStageCreateInfo Shader::getStageInfo(const vk::SpecializationInfo* specialization) const
+{
+	return vk::PipelineShaderStageCreateInfo{ {}, getStage(), **m_module, findEntryPoint(), specialization };
+}
+
+SpecializationConstants& SpecializationConstants::set(uint32_t constantId, float value)
+{
+	setBytes(constantId, &value, sizeof(value));
+	return *this;
+}
+
+SpecializationConstants& SpecializationConstants::set(uint32_t constantId, int32_t value)
 {
-	if (m_code.empty()) throw std::runtime_error("Shader code not found. Path = " + m_path);
+	setBytes(constantId, &value, sizeof(value));
+	return *this;
 }
 
-Shader::Shader(Shader&& other) :
-	m_path(std::move(other.m_path)),
-	m_code(std::move(other.m_code)),
-	m_handle(other.m_handle)
+SpecializationConstants& SpecializationConstants::set(uint32_t constantId, uint32_t value)
 {
-	other.m_handle = nullptr;
+	setBytes(constantId, &value, sizeof(value));
+	return *this;
 }
 
-Shader::~Shader()
+SpecializationConstants& SpecializationConstants::set(uint32_t constantId, bool value)
 {
-	vkRenderCtx.device.destroy(m_handle);
+	VkBool32 b = value ? VK_TRUE : VK_FALSE;
+	setBytes(constantId, &b, sizeof(b));
+	return *this;
 }
 
-vk::PipelineShaderStageCreateInfo Shader::getStageInfo() const
+void SpecializationConstants::setBytes(uint32_t constantId, const void* value, size_t size)
 {
-	return vk::PipelineShaderStageCreateInfo{ {}, getStage(), m_handle, findEntryPoint() };
+	// Entries and data are kept in constant id order, so the same values always give the same bytes and share a pipeline.
+	auto it = std::lower_bound(m_entries.begin(), m_entries.end(), constantId, [](const vk::SpecializationMapEntry& e, uint32_t id) { return e.constantID < id; });
+	if (it == m_entries.end() || it->constantID != constantId)
+	{
+		uint32_t offset = it == m_entries.end() ? static_cast<uint32_t>(m_data.size()) : it->offset;
+		for (auto later = it; later != m_entries.end(); ++later)
+			later->offset += static_cast<uint32_t>(size);
+
+		it = m_entries.insert(it, vk::SpecializationMapEntry{ constantId, offset, size });
+		m_data.insert(m_data.begin() + offset, size, 0);
+	}
+	else if (it->size != size)
+		throw std::runtime_error("Specialization constant " + std::to_string(constantId) + " set with a different size.");
+
+	std::memcpy(m_data.data() + it->offset, value, size);
+}
+
+const void* SpecializationConstants::value(uint32_t constantId) const
+{
+	auto it = std::lower_bound(m_entries.begin(), m_entries.end(), constantId, [](const vk::SpecializationMapEntry& e, uint32_t id) { return e.constantID < id; });
+	return it != m_entries.end() && it->constantID == constantId ? m_data.data() + it->offset : nullptr;
+}
+
+const vk::SpecializationInfo* SpecializationConstants::info()
+{
+	if (m_entries.empty()) return nullptr;
+
+	m_info = vk::SpecializationInfo{ static_cast<uint32_t>(m_entries.size()), m_entries.data(), m_data.size(), m_data.data() };
+	return &m_info;
 }
@@ -5,36 +5,83 @@
 #define SHADER_H
 
 #include <vulkan/vulkan.hpp>
+#include <memory>
 #include <string>
 
+#include "mapped_file.h"
+#include "reflection.h"
+
+// Values for a stage's specialization constants, with the storage a vk::SpecializationInfo points at.
+class SpecializationConstants
+{
+public:
+	SpecializationConstants& set(uint32_t constantId, float value);
+	SpecializationConstants& set(uint32_t constantId, int32_t value);
+	SpecializationConstants& set(uint32_t constantId, uint32_t value);
+	SpecializationConstants& set(uint32_t constantId, bool value);
+
+	bool empty() const
+	{
+		return m_entries.empty();
+	}
+	// Null when the constant isn't set.
+	const void* value(uint32_t constantId) const;
+
+	// Null when nothing is set. Points into this object, so it's only valid until it is moved or changed.
+	const vk::SpecializationInfo* info();
+
+private:
+	void setBytes(uint32_t constantId, const void* value, size_t size);
+
+	std::vector<vk::SpecializationMapEntry> m_entries;
+	std::vector<uint8_t> m_data;
+	vk::SpecializationInfo m_info;
+};
+
 class Shader
 {
 	// Static Stuff
 public:
 
+	// Thread safe. References stay valid until FreeShaders().
 	static const Shader& FetchShader(const std::string& path);
 	static void FreeShaders();
+	// Loads the file again into the existing Shader, so pointers to it stay valid. Does nothing for shaders never fetched.
+	// Returns the replaced module, which has to be kept alive until the pipelines built from it are gone.
+	static std::shared_ptr<const vk::UniqueShaderModule> ReloadShader(const std::string& path);
 
 
 private:
 
 	Shader(std::string path);
+	Shader(const MappedFile& code);
 
 	std::string m_path;
-	std::string m_code;
-	vk::ShaderModule m_handle;
+	ShaderReflection m_reflection;
+	// Shared by every path with the same SPIR-V.
+	std::shared_ptr<const vk::UniqueShaderModule> m_module;
+
+	static std::shared_ptr<const vk::UniqueShaderModule> FetchModule(const MappedFile& code);
 
-	std::string getCode() const;
 	vk::ShaderStageFlagBits getStage() const;
 	const char* findEntryPoint() const;
 
 public:
 
-	~Shader();
 	Shader(const Shader&) = delete;
-	Shader(Shader&& other);
+	Shader(Shader&& other) = default;
+	Shader& operator=(Shader&& other) = default;
+
+	vk::PipelineShaderStageCreateInfo getStageInfo(const vk::SpecializationInfo* specialization = nullptr) const;
 
-	vk::PipelineShaderStageCreateInfo getStageInfo() const;
+	const std::string& path() const
+	{
+		return m_path;
+	}
+	const ShaderReflection& reflection() const
+	{
+		return m_reflection;
+	}
 
 };
 
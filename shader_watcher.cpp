@@ -0,0 +1,69 @@
+#include "stdafx.h"
+
+#include "shader_watcher.h"
+
+#ifdef __linux__
+#	include <sys/inotify.h>
+#	include <unistd.h>
+#	include <cerrno>
+#endif
+
+ShaderWatcher::ShaderWatcher(std::string directory) :
+	m_directory(std::move(directory))
+{
+#ifdef __linux__
+	m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_fd < 0) throw std::runtime_error("Failed to create inotify instance.");
+
+	// Compilers either write the file in place or rename a finished temporary over it.
+	if (inotify_add_watch(m_fd, m_directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		// Hot reload is a convenience, a missing directory just means there is nothing to watch.
+		std::cerr << "Can't watch shader directory. Path = " << m_directory << std::endl;
+		::close(m_fd);
+		m_fd = -1;
+	}
+#endif
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+#ifdef __linux__
+	if (m_fd >= 0)
+		::close(m_fd);
+#endif
+}
+
+std::vector<std::string> ShaderWatcher::poll()
+{
+	std::vector<std::string> changed;
+
+#ifdef __linux__
+	if (m_fd < 0) return changed;
+
+	alignas(inotify_event) char buffer[4096];
+	for (;;)
+	{
+		ssize_t length = read(m_fd, buffer, sizeof(buffer));
+		if (length <= 0)
+			break;
+
+		for (char* p = buffer; p < buffer + length;)
+		{
+			auto event = reinterpret_cast<const inotify_event*>(p);
+			p += sizeof(inotify_event) + event->len;
+
+			if (event->len == 0) continue;
+
+			std::string name = event->name;
+			if (name.size() < 4 || name.compare(name.size() - 4, 4, ".spv") != 0) continue;
+
+			std::string path = m_directory + "/" + name;
+			if (std::find(changed.begin(), changed.end(), path) == changed.end())
+				changed.push_back(std::move(path));
+		}
+	}
+#endif
+
+	return changed;
+}
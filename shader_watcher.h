@@ -0,0 +1,29 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef SHADER_WATCHER_H
+#define SHADER_WATCHER_H
+
+#include <string>
+#include <vector>
+
+// Reports SPIR-V files in a directory that were rewritten since the last poll.
+// Only implemented on Linux with inotify, elsewhere nothing is ever reported.
+class ShaderWatcher
+{
+public:
+	explicit ShaderWatcher(std::string directory);
+	~ShaderWatcher();
+
+	ShaderWatcher(const ShaderWatcher&) = delete;
+	ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+	// Never blocks. Paths are the directory joined with the file name, the same form the shaders are fetched with.
+	std::vector<std::string> poll();
+
+private:
+	std::string m_directory;
+	int m_fd = -1;
+};
+
+#endif
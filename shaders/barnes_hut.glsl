@@ -0,0 +1,60 @@
+// Shared by the barnes_hut_*.comp passes, they all use one pipeline layout.
+
+struct node
+{
+    vec4 com; // Centre of mass in xyz, mass in w.
+    vec4 boundsMin;
+    vec4 boundsMax;
+    int left; // Children are -1 for leaves.
+    int right;
+    int parent;
+    int visits;
+};
+
+layout(std430, binding = 0) readonly buffer PositionsIn
+{
+    vec4 positionsIn[]; // Mass in w.
+};
+
+layout(std430, binding = 1) readonly buffer VelocitiesIn
+{
+    vec4 velocitiesIn[];
+};
+
+layout(std430, binding = 2) writeonly buffer PositionsOut
+{
+    vec4 positionsOut[];
+};
+
+layout(std430, binding = 3) writeonly buffer VelocitiesOut
+{
+    vec4 velocitiesOut[];
+};
+
+// Floats mapped to uints that order the same way, so atomicMin/Max work on them.
+layout(std430, binding = 4) buffer Bounds
+{
+    uint boundsMin[3];
+    uint boundsMax[3];
+};
+
+layout(std430, binding = 5) buffer Keys
+{
+    uint keys[];
+};
+
+layout(std430, binding = 6) buffer Values
+{
+    uint values[];
+};
+
+// Internal nodes first, the leaf of sorted particle k is at count - 1 + k.
+layout(std430, binding = 7) coherent buffer Nodes
+{
+    node nodes[];
+};
+
+layout(push_constant) uniform Params
+{
+    uint count;
+} params;
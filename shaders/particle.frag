@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(constant_id = 0) const float INTENSITY = 0.25; // Particles blend additively, dense regions saturate.
+
+layout(location = 0) in vec2 uv;
+layout(location = 1) in vec3 col;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+	float falloff = max(1.0 - dot(uv, uv), 0.0);
+	outColor = vec4(col * falloff * INTENSITY, 1);
+}
@@ -0,0 +1,45 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Reads the simulation's draw buffers directly, one instance per particle as a camera facing quad, or one vertex per particle as a point.
+// Positions are interpolated between the last two steps, so motion stays smooth when frames and steps don't line up.
+
+layout(constant_id = 0) const bool BILLBOARD = true;
+layout(constant_id = 1) const float SIZE = 0.004; // Half size of a billboard in view space.
+
+out gl_PerVertex {
+    vec4 gl_Position;
+	float gl_PointSize;
+};
+
+layout(set = 0, binding = 0) uniform RenderData
+{
+	mat4 projection;
+	mat4 view;
+	float particleInterpolation;
+} render;
+
+layout(location = 0) in vec3 previousPosition;
+layout(location = 1) in vec3 position;
+layout(location = 2) in vec3 velocity;
+
+layout(location = 0) out vec2 uv;
+layout(location = 1) out vec3 col;
+
+void main() {
+    vec4 viewPos = render.view * vec4(mix(previousPosition, position, render.particleInterpolation), 1);
+
+    uv = vec2(0);
+    if (BILLBOARD)
+    {
+        // Corners of a triangle strip.
+        uv = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1) * 2.0 - 1.0;
+        viewPos.xy += uv * SIZE;
+    }
+
+    gl_Position = render.projection * viewPos;
+    gl_PointSize = 1.0;
+
+    // Slow particles glow warm, fast ones blue.
+    col = mix(vec3(1.0, 0.6, 0.3), vec3(0.4, 0.6, 1.0), clamp(length(velocity) * 0.05, 0.0, 1.0));
+}
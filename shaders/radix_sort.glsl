@@ -0,0 +1,52 @@
+// Shared by the radix_sort_*.comp passes, they all use one pipeline layout.
+// Least significant digit first radix sort, every pass sorts stably by the RADIX_BITS bits at params.shift.
+
+layout(constant_id = 0) const uint KEY_WORDS = 1; // 2 for 64 bit keys, stored low word first.
+layout(constant_id = 1) const bool HAS_VALUES = true;
+
+const uint RADIX_BITS = 4;
+const uint RADIX = 1u << RADIX_BITS;
+
+layout(std430, binding = 0) readonly buffer KeysIn
+{
+    uint keysIn[];
+};
+
+layout(std430, binding = 1) writeonly buffer KeysOut
+{
+    uint keysOut[];
+};
+
+layout(std430, binding = 2) readonly buffer ValuesIn
+{
+    uint valuesIn[];
+};
+
+layout(std430, binding = 3) writeonly buffer ValuesOut
+{
+    uint valuesOut[];
+};
+
+// Digit major, the count of digit d in workgroup g is at d * groupCount + g. The scan turns the counts into output offsets in place.
+layout(std430, binding = 4) buffer Histograms
+{
+    uint histograms[];
+};
+
+layout(push_constant) uniform Params
+{
+    uint count;
+    uint groupCount;
+    uint shift; // Lowest bit of the digit this pass sorts by.
+} params;
+
+uvec2 loadKey(uint i)
+{
+    return uvec2(keysIn[i * KEY_WORDS], KEY_WORDS > 1 ? keysIn[i * KEY_WORDS + 1] : 0);
+}
+
+uint digitOf(uvec2 key)
+{
+    uint word = params.shift < 32 ? key.x : key.y;
+    return (word >> (params.shift & 31)) & (RADIX - 1);
+}
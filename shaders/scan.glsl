@@ -0,0 +1,39 @@
+// Exclusive prefix sum over size elements, run by a single workgroup.
+// Each invocation sums a contiguous chunk, the chunk totals are scanned in shared memory and then every chunk is written out.
+// The including shader defines scanLoad(i) and scanStore(i, offset) first, storing back in place is fine.
+
+shared uint chunkTotals[gl_WorkGroupSize.x];
+
+void exclusiveScan(uint size)
+{
+    uint l = gl_LocalInvocationID.x;
+    uint chunk = (size + gl_WorkGroupSize.x - 1) / gl_WorkGroupSize.x;
+    uint begin = min(l * chunk, size);
+    uint end = min(begin + chunk, size);
+
+    uint total = 0;
+    for (uint i = begin; i < end; ++i)
+        total += scanLoad(i);
+    chunkTotals[l] = total;
+
+    // Inclusive scan over the chunk totals.
+    for (uint stride = 1; stride < gl_WorkGroupSize.x; stride *= 2)
+    {
+        memoryBarrierShared();
+        barrier();
+        uint add = l >= stride ? chunkTotals[l - stride] : 0;
+        memoryBarrierShared();
+        barrier();
+        chunkTotals[l] += add;
+    }
+    memoryBarrierShared();
+    barrier();
+
+    uint offset = chunkTotals[l] - total;
+    for (uint i = begin; i < end; ++i)
+    {
+        uint n = scanLoad(i);
+        scanStore(i, offset);
+        offset += n;
+    }
+}
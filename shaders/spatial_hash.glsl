@@ -0,0 +1,67 @@
+// Shared by the spatial_hash_*.comp passes, they all use one pipeline layout.
+// Particles are counting sorted into the cells of a uniform grid, hashed into a table so the grid is unbounded.
+
+layout(constant_id = 4) const float CELL_SIZE = 0.01; // Also the interaction range, so neighbours are in the 27 surrounding cells.
+
+layout(std430, binding = 0) readonly buffer PositionsIn
+{
+    vec4 positionsIn[]; // Mass in w.
+};
+
+layout(std430, binding = 1) readonly buffer VelocitiesIn
+{
+    vec4 velocitiesIn[];
+};
+
+layout(std430, binding = 2) writeonly buffer PositionsOut
+{
+    vec4 positionsOut[];
+};
+
+layout(std430, binding = 3) writeonly buffer VelocitiesOut
+{
+    vec4 velocitiesOut[];
+};
+
+// Particles per table entry, then where each entry's particles start in sortedIndices.
+layout(std430, binding = 4) buffer CellCounts
+{
+    uint cellCounts[];
+};
+
+layout(std430, binding = 5) buffer CellStarts
+{
+    uint cellStarts[];
+};
+
+layout(std430, binding = 6) buffer ParticleCells
+{
+    uint particleCells[];
+};
+
+layout(std430, binding = 7) buffer ParticleRanks
+{
+    uint particleRanks[]; // Order of the particle within its table entry.
+};
+
+layout(std430, binding = 8) buffer SortedIndices
+{
+    uint sortedIndices[];
+};
+
+layout(push_constant) uniform Params
+{
+    uint count;
+    uint tableSize; // Power of two.
+} params;
+
+ivec3 cellOf(vec3 position)
+{
+    return ivec3(floor(position / CELL_SIZE));
+}
+
+uint hashCell(ivec3 cell)
+{
+    uvec3 c = uvec3(cell);
+    return ((c.x * 73856093u) ^ (c.y * 19349663u) ^ (c.z * 83492791u)) & (params.tableSize - 1);
+}
@@ -2,12 +2,13 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 layout(location = 0) in vec2 texCoord;
+layout(location = 1) flat in uint texLayer;
 
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 0) uniform sampler2D texSampler;
+layout(binding = 0) uniform sampler2DArray texSampler;
 
 void main() {
-    outColor = texture(texSampler, texCoord);
+    outColor = texture(texSampler, vec3(texCoord, texLayer));
 	//outColor = vec4(texCoord,0,1);
 }
\ No newline at end of file
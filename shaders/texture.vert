@@ -10,8 +10,10 @@ layout(location = 0) in vec2 vpos;
 layout(location = 1) in vec2 tpos;
 layout(location = 2) in vec2 pos;
 layout(location = 3) in vec2 scale;
+layout(location = 4) in uint layer;
 
 layout(location = 0) out vec2 texCoord;
+layout(location = 1) flat out uint texLayer;
 
 
 vec2 scales[4] = vec2[](
@@ -24,4 +26,5 @@ vec2 scales[4] = vec2[](
 void main() {
     gl_Position = vec4(pos + vpos * scale,0,1);
     texCoord = tpos;
+    texLayer = layer;
 }
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec2 texCoord;
+layout(location = 1) flat in uint texLayer;
+
+layout(location = 0) out vec4 outColor;
+
+layout(binding = 0) uniform sampler2D textures[];
+
+void main() {
+    outColor = texture(textures[nonuniformEXT(texLayer)], texCoord);
+}
@@ -0,0 +1,218 @@
+#include "stdafx.h"
+#include "spatial_hash.h"
+
+#include <algorithm>
+#include "particles.h"
+#include "renderer.h"
+
+namespace
+{
+	// Matches Params in shaders/spatial_hash.glsl.
+	struct Params
+	{
+		uint32_t count;
+		uint32_t tableSize;
+	};
+
+	uint32_t powerOfTwoCeil(uint32_t v)
+	{
+		uint32_t p = 1;
+		while (p < v)
+			p *= 2;
+		return p;
+	}
+
+	// Same as cellOf() and hashCell() in shaders/spatial_hash.glsl.
+	glm::ivec3 cellOf(glm::vec3 position, float cellSize)
+	{
+		return glm::ivec3(glm::floor(position / cellSize));
+	}
+
+	uint32_t hashCell(glm::ivec3 cell, uint32_t tableSize)
+	{
+		glm::uvec3 c(cell);
+		return ((c.x * 73856093u) ^ (c.y * 19349663u) ^ (c.z * 83492791u)) & (tableSize - 1);
+	}
+}
+
+SpatialHash::SpatialHash(uint32_t count, const std::vector<vk::Buffer>& positions, const std::vector<vk::Buffer>& velocities, PipelineLayoutCache& layouts, PipelineRegistry& registry, const SpatialHashParams& params) :
+	m_count(count),
+	m_tableSize(powerOfTwoCeil(count)),
+	m_states(static_cast<uint32_t>(positions.size()))
+{
+	if (count == 0) throw std::runtime_error("Spatial hash needs at least one particle.");
+	if (velocities.size() != positions.size()) throw std::runtime_error("Spatial hash needs as many velocity buffers as position buffers.");
+
+	// The hash table's counts and starts, and each particle's entry, rank within it and place in the sorted order.
+	{
+		auto usage = vk::BufferUsageFlagBits::eStorageBuffer;
+
+		m_cellCounts = Renderer::createBufferUnique(m_tableSize * sizeof(uint32_t), usage | vk::BufferUsageFlagBits::eTransferDst, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_cellStarts = Renderer::createBufferUnique(m_tableSize * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_particleCells = Renderer::createBufferUnique(count * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_particleRanks = Renderer::createBufferUnique(count * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+		m_sortedIndices = Renderer::createBufferUnique(count * sizeof(uint32_t), usage, VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+
+	// Pipelines. The four passes share one layout, a step binds its descriptor set and pushes the table size once.
+	{
+		const std::array<const char*, PassCount> paths{ {
+			"shaders/spatial_hash_count.comp.spv",
+			"shaders/spatial_hash_scan.comp.spv",
+			"shaders/spatial_hash_scatter.comp.spv",
+			"shaders/spatial_hash_collide.comp.spv"
+		} };
+
+		std::vector<const Shader*> shaders;
+		for (auto path : paths)
+			shaders.push_back(&Shader::FetchShader(path));
+		PipelineInterface pipelineInterface = PipelineInterface::Reflect(shaders);
+		vk::PipelineLayout layout = layouts.getPipelineLayout(pipelineInterface);
+
+		const auto& limits = vkRenderCtx.physicalDeviceProperties.limits;
+		uint32_t groupSize = std::min({ 256u, limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations });
+
+		for (uint32_t pass = 0; pass < PassCount; ++pass)
+		{
+			m_passes[pass].setShader(paths[pass]);
+			m_passes[pass].specialize("local_size_x", groupSize);
+			m_passes[pass].specialize("CELL_SIZE", params.cellSize);
+			m_passes[pass].setLayout(layout);
+		}
+
+		m_passes[Collide].specialize("TIME_STEP", params.timeStep);
+		m_passes[Collide].specialize("STIFFNESS", params.stiffness);
+		m_passes[Collide].specialize("DAMPING", params.damping);
+
+		for (auto& pass : m_passes)
+			pass.create(registry);
+
+		// Descriptors
+		vk::DescriptorSetLayout setLayout = layouts.getDescriptorSetLayout(pipelineInterface.sets.at(0));
+
+		vk::DescriptorBufferInfo cellCounts{ m_cellCounts->value, 0, VK_WHOLE_SIZE };
+		vk::DescriptorBufferInfo cellStarts{ m_cellStarts->value, 0, VK_WHOLE_SIZE };
+		vk::DescriptorBufferInfo particleCells{ m_particleCells->value, 0, VK_WHOLE_SIZE };
+		vk::DescriptorBufferInfo particleRanks{ m_particleRanks->value, 0, VK_WHOLE_SIZE };
+		vk::DescriptorBufferInfo sortedIndices{ m_sortedIndices->value, 0, VK_WHOLE_SIZE };
+
+		m_descriptorSets = ParticleSimulation::AllocateStepSets(m_descriptorPool, setLayout, count * sizeof(glm::vec4), positions, velocities, { cellCounts, cellStarts, particleCells, particleRanks, sortedIndices });
+	}
+}
+
+void SpatialHash::record(vk::CommandBuffer cb, uint32_t in, uint32_t out)
+{
+	const vk::AccessFlags readWrite = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+	auto barrier = [&cb, readWrite]() { ComputePipeline::barrier(cb, vk::PipelineStageFlagBits::eComputeShader, readWrite); };
+
+	// The previous step may still be reading the counts.
+	cb.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, {});
+	cb.fillBuffer(m_cellCounts->value, 0, VK_WHOLE_SIZE, 0);
+	cb.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {},
+		{ vk::MemoryBarrier{ vk::AccessFlagBits::eTransferWrite, readWrite } }, {}, {});
+
+	Params params{ m_count, m_tableSize };
+
+	m_passes[Count].bind(cb);
+	m_passes[Count].bindDescriptorSets(cb, 0, { m_descriptorSets[in * m_states + out] });
+	m_passes[Count].pushConstants(cb, 0, sizeof(params), &params);
+	m_passes[Count].dispatchInvocations(cb, m_count);
+	barrier();
+
+	// One workgroup walks the whole table.
+	m_passes[Scan].bind(cb);
+	m_passes[Scan].dispatch(cb, 1);
+	barrier();
+
+	m_passes[Scatter].bind(cb);
+	m_passes[Scatter].dispatchInvocations(cb, m_count);
+	barrier();
+
+	m_passes[Collide].bind(cb);
+	m_passes[Collide].dispatchInvocations(cb, m_count);
+}
+
+std::vector<ComputePipeline*> SpatialHash::pipelines()
+{
+	std::vector<ComputePipeline*> pipelines;
+	for (auto& pass : m_passes)
+		pipelines.push_back(&pass);
+	return pipelines;
+}
+
+void SpatialHash::StepCpu(const ParticleState& in, ParticleState& out, ThreadPool& threadPool, const SpatialHashParams& params)
+{
+	size_t count = in.size();
+	if (count == 0) throw std::runtime_error("Spatial hash needs at least one particle.");
+
+	out.resize(count);
+	uint32_t tableSize = powerOfTwoCeil(static_cast<uint32_t>(count));
+
+	std::vector<uint32_t> particleCells(count);
+	threadPool.parallelFor(count, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+			particleCells[i] = hashCell(cellOf(glm::vec3(in.positions[i]), params.cellSize), tableSize);
+	});
+
+	// The counting sort itself is a couple of linear passes, cheaper serial than merging per thread histograms of the whole table.
+	std::vector<uint32_t> cellCounts(tableSize, 0);
+	for (uint32_t cell : particleCells)
+		++cellCounts[cell];
+
+	std::vector<uint32_t> cellStarts(tableSize);
+	uint32_t start = 0;
+	for (uint32_t h = 0; h < tableSize; ++h)
+	{
+		cellStarts[h] = start;
+		start += cellCounts[h];
+	}
+
+	std::vector<uint32_t> sortedIndices(count);
+	{
+		std::vector<uint32_t> next = cellStarts;
+		for (size_t i = 0; i < count; ++i)
+			sortedIndices[next[particleCells[i]]++] = static_cast<uint32_t>(i);
+	}
+
+	threadPool.parallelFor(count, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			glm::vec4 pos = in.positions[i];
+			glm::vec3 velocity(in.velocities[i]);
+			glm::ivec3 cell = cellOf(glm::vec3(pos), params.cellSize);
+			glm::vec3 acc(0.0f);
+
+			for (int z = -1; z <= 1; ++z)
+			for (int y = -1; y <= 1; ++y)
+			for (int x = -1; x <= 1; ++x)
+			{
+				glm::ivec3 neighbour = cell + glm::ivec3(x, y, z);
+				uint32_t h = hashCell(neighbour, tableSize);
+
+				for (uint32_t s = cellStarts[h]; s < cellStarts[h] + cellCounts[h]; ++s)
+				{
+					uint32_t j = sortedIndices[s];
+					glm::vec3 other(in.positions[j]);
+
+					if (j == i || cellOf(other, params.cellSize) != neighbour)
+						continue;
+
+					glm::vec3 offset = glm::vec3(pos) - other;
+					float dist = glm::length(offset);
+					if (dist >= params.cellSize || dist == 0.0f)
+						continue;
+
+					glm::vec3 normal = offset / dist;
+					float approach = std::min(glm::dot(velocity - glm::vec3(in.velocities[j]), normal), 0.0f);
+					acc += normal * (params.stiffness * (params.cellSize - dist) - params.damping * approach);
+				}
+			}
+
+			velocity += acc * params.timeStep;
+			out.velocities[i] = glm::vec4(velocity, 0.0f);
+			out.positions[i] = glm::vec4(glm::vec3(pos) + velocity * params.timeStep, pos.w);
+		}
+	});
+}
@@ -0,0 +1,67 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <array>
+#include "globals.h"
+#include "pipeline.h"
+#include "particles_cpu.h"
+#include "thread_pool.h"
+
+// Same defaults as the specialization constants in the shaders.
+struct SpatialHashParams
+{
+	float timeStep = 0.001f;
+	float cellSize = 0.01f; // Particle diameter, nothing interacts further apart than one cell.
+	float stiffness = 1000.0f;
+	float damping = 5.0f;
+};
+
+// Short range interactions on the GPU. Each step counting sorts the particles into the cells of a uniform grid,
+// hashed into a table of at least one entry per particle, and each particle then only looks at the 27 cells around it.
+// The collisions in shaders/spatial_hash_collide.comp are the first user, other passes can include shaders/spatial_hash.glsl.
+class SpatialHash
+{
+public:
+	// Steps between any two of a ring of states, a position and a velocity buffer each.
+	SpatialHash(uint32_t count, const std::vector<vk::Buffer>& positions, const std::vector<vk::Buffer>& velocities, PipelineLayoutCache& layouts, PipelineRegistry& registry, const SpatialHashParams& params = {});
+
+	// Records a step reading state in and writing state out, out of the states passed to the constructor.
+	void record(vk::CommandBuffer cb, uint32_t in, uint32_t out);
+
+	// For shader reloads.
+	std::vector<ComputePipeline*> pipelines();
+
+	// Same step on the CPU, split over the pool's threads. Gives the result the GPU should match.
+	static void StepCpu(const ParticleState& in, ParticleState& out, ThreadPool& threadPool, const SpatialHashParams& params = {});
+
+private:
+	enum Pass
+	{
+		Count,
+		Scan,
+		Scatter,
+		Collide,
+		PassCount
+	};
+
+	uint32_t m_count;
+	uint32_t m_tableSize;
+	uint32_t m_states;
+
+	UniqueVmaAlloc<vk::Buffer> m_cellCounts;
+	UniqueVmaAlloc<vk::Buffer> m_cellStarts;
+	UniqueVmaAlloc<vk::Buffer> m_particleCells;
+	UniqueVmaAlloc<vk::Buffer> m_particleRanks;
+	UniqueVmaAlloc<vk::Buffer> m_sortedIndices;
+
+	std::array<ComputePipeline, PassCount> m_passes;
+	vk::UniqueDescriptorPool m_descriptorPool;
+	std::vector<vk::DescriptorSet> m_descriptorSets; // Set i * states + j reads state i and writes state j, sets with i == j are unused.
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock free queue between exactly one producer thread and one consumer thread.
+// Neither side ever waits on the other, a full queue fails the push and an empty one the pop.
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity has to be a power of two.");
+
+public:
+	// Producer only.
+	bool tryPush(const T& value)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+			return false;
+
+		m_items[tail % Capacity] = value;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only.
+	bool tryPop(T& value)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+
+		value = m_items[head % Capacity];
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::array<T, Capacity> m_items;
+
+	// On their own cache lines, so the two threads don't keep taking the line from each other.
+	alignas(64) std::atomic<size_t> m_head{ 0 }; // Written by the consumer.
+	alignas(64) std::atomic<size_t> m_tail{ 0 }; // Written by the producer.
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "stdafx.h"
+
+#include "texture.h"
+
+// Offline texture cooker, converts source images into .vktex files that the renderer maps straight into staging buffers.
+// Usage: texcook [--bc1|--bc3] input...
+// Each input is written next to itself with the .vktex extension.
+
+static std::string cookedPath(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + TextureData::CookedExtension;
+	return path.substr(0, dot) + TextureData::CookedExtension;
+}
+
+static void printUsage()
+{
+	std::cerr << "Usage: texcook [--bc1|--bc3] input..." << std::endl;
+	std::cerr << "  --bc1   Encode as BC1, alpha is dropped." << std::endl;
+	std::cerr << "  --bc3   Encode as BC3." << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	vk::Format encoding = vk::Format::eUndefined;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--bc1")
+			encoding = vk::Format::eBc1RgbaUnormBlock;
+		else if (arg == "--bc3")
+			encoding = vk::Format::eBc3UnormBlock;
+		else if (arg.size() > 1 && arg[0] == '-')
+		{
+			printUsage();
+			return 1;
+		}
+		else
+			inputs.push_back(arg);
+	}
+
+	if (inputs.empty())
+	{
+		printUsage();
+		return 1;
+	}
+
+	try {
+		for (auto& input : inputs)
+		{
+			std::string output = cookedPath(input);
+			if (output == input)
+				throw std::runtime_error("Texture is already cooked. Path = " + input);
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			TextureData texture = TextureData::Load(input);
+
+			// Mips are built from full precision texels, so compressed sources are decoded first if anything needs doing to them.
+			bool needsMips = texture.levels().size() == 1 && TextureData::MipLevelCount(texture.width(), texture.height()) > 1;
+			if (TextureData::IsBlockCompressed(texture.format()) && (needsMips || (encoding != vk::Format::eUndefined && encoding != texture.format())))
+				texture.decompress();
+
+			if (needsMips)
+				texture.generateMips();
+
+			if (encoding != vk::Format::eUndefined && encoding != texture.format())
+				texture.compress(encoding);
+
+			texture.save(output);
+
+			auto end = std::chrono::high_resolution_clock::now();
+
+			std::cout << input << " -> " << output << " ("
+				<< texture.width() << 'x' << texture.height() << ", "
+				<< texture.levels().size() << " levels, "
+				<< vk::to_string(texture.format()) << ") in "
+				<< std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+		}
+	}
+	catch (std::runtime_error e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,952 @@
+#include "stdafx.h"
+#include <stb_image.h>
+#include <limits>
+
+#include "texture.h"
+#include "globals.h"
+
+namespace
+{
+	struct ContainerHeader
+	{
+		TextureInfo info;
+		std::vector<TextureLevel> levels; // Offsets are relative to the start of the file.
+	};
+
+	template<typename T>
+	T read(const uint8_t* data, size_t offset)
+	{
+		T value;
+		memcpy(&value, data + offset, sizeof(T));
+		return value;
+	}
+
+	std::vector<uint8_t> readFile(const std::string& path, size_t maxBytes = std::numeric_limits<size_t>::max())
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file) throw std::runtime_error("Image file not found. Path = " + path);
+
+		size_t size = std::min(static_cast<size_t>(file.tellg()), maxBytes);
+		file.seekg(0);
+
+		std::vector<uint8_t> data(size);
+		file.read(reinterpret_cast<char*>(data.data()), size);
+		return data;
+	}
+
+	bool hasExtension(const std::string& path, const char* ext)
+	{
+		size_t len = strlen(ext);
+		if (path.size() < len) return false;
+		return std::equal(path.end() - len, path.end(), ext, [](char a, char b) { return tolower(a) == b; });
+	}
+
+	std::vector<TextureLevel> levelChain(vk::Format format, uint32_t width, uint32_t height, uint32_t nLevels)
+	{
+		std::vector<TextureLevel> levels;
+		levels.reserve(nLevels);
+
+		size_t offset = 0;
+		for (uint32_t level = 0; level < nLevels; ++level)
+		{
+			size_t size = TextureData::LevelSize(format, width, height);
+			levels.push_back(TextureLevel{ width, height, offset, size });
+			offset += size;
+
+			width = std::max(width / 2, 1u);
+			height = std::max(height / 2, 1u);
+		}
+
+		return levels;
+	}
+
+	vk::Format dxgiFormat(uint32_t format)
+	{
+		switch (format)
+		{
+		case 28: return vk::Format::eR8G8B8A8Unorm;
+		case 29: return vk::Format::eR8G8B8A8Srgb;
+		case 71: return vk::Format::eBc1RgbaUnormBlock;
+		case 72: return vk::Format::eBc1RgbaSrgbBlock;
+		case 77: return vk::Format::eBc3UnormBlock;
+		case 78: return vk::Format::eBc3SrgbBlock;
+		case 98: return vk::Format::eBc7UnormBlock;
+		case 99: return vk::Format::eBc7SrgbBlock;
+		default: return vk::Format::eUndefined;
+		}
+	}
+
+	constexpr uint32_t fourCC(char a, char b, char c, char d)
+	{
+		return uint32_t(a) | (uint32_t(b) << 8) | (uint32_t(c) << 16) | (uint32_t(d) << 24);
+	}
+
+	bool isSupportedFormat(vk::Format format)
+	{
+		switch (format)
+		{
+		case vk::Format::eR8G8B8A8Unorm:
+		case vk::Format::eR8G8B8A8Srgb:
+		case vk::Format::eBc1RgbaUnormBlock:
+		case vk::Format::eBc1RgbaSrgbBlock:
+		case vk::Format::eBc3UnormBlock:
+		case vk::Format::eBc3SrgbBlock:
+		case vk::Format::eBc7UnormBlock:
+		case vk::Format::eBc7SrgbBlock:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	ContainerHeader parseDDS(const uint8_t* data, size_t size, const std::string& path)
+	{
+		const size_t headerStart = 4, pixelFormatStart = headerStart + 72;
+		size_t dataOffset = headerStart + 124;
+
+		if (size < dataOffset || read<uint32_t>(data, 0) != fourCC('D', 'D', 'S', ' ') || read<uint32_t>(data, headerStart) != 124)
+			throw std::runtime_error("Invalid DDS header. Path = " + path);
+
+		uint32_t flags = read<uint32_t>(data, headerStart + 4);
+		uint32_t height = read<uint32_t>(data, headerStart + 8);
+		uint32_t width = read<uint32_t>(data, headerStart + 12);
+		uint32_t mipCount = (flags & 0x20000) ? std::max(read<uint32_t>(data, headerStart + 24), 1u) : 1u; // DDSD_MIPMAPCOUNT
+
+		if (width == 0 || height == 0 || mipCount == 0 || mipCount > TextureData::MipLevelCount(width, height))
+			throw std::runtime_error("Invalid DDS header. Path = " + path);
+
+		uint32_t pfFlags = read<uint32_t>(data, pixelFormatStart + 4);
+		uint32_t pfFourCC = read<uint32_t>(data, pixelFormatStart + 8);
+
+		vk::Format format = vk::Format::eUndefined;
+		if (pfFlags & 0x4) // DDPF_FOURCC
+		{
+			if (pfFourCC == fourCC('D', 'X', 'T', '1'))
+				format = vk::Format::eBc1RgbaUnormBlock;
+			else if (pfFourCC == fourCC('D', 'X', 'T', '5'))
+				format = vk::Format::eBc3UnormBlock;
+			else if (pfFourCC == fourCC('D', 'X', '1', '0'))
+			{
+				if (size < dataOffset + 20)
+					throw std::runtime_error("Invalid DDS header. Path = " + path);
+
+				format = dxgiFormat(read<uint32_t>(data, dataOffset));
+				dataOffset += 20;
+			}
+		}
+		else if ((pfFlags & 0x40) && read<uint32_t>(data, pixelFormatStart + 12) == 32 // DDPF_RGB, 32 bpp
+			&& read<uint32_t>(data, pixelFormatStart + 16) == 0x000000ff
+			&& read<uint32_t>(data, pixelFormatStart + 20) == 0x0000ff00
+			&& read<uint32_t>(data, pixelFormatStart + 24) == 0x00ff0000)
+		{
+			format = vk::Format::eR8G8B8A8Unorm;
+		}
+
+		if (format == vk::Format::eUndefined)
+			throw std::runtime_error("Unsupported DDS pixel format. Path = " + path);
+
+		ContainerHeader header{ TextureInfo{ width, height, format, mipCount }, levelChain(format, width, height, mipCount) };
+		for (auto& level : header.levels)
+			level.offset += dataOffset;
+
+		return header;
+	}
+
+	const uint8_t ktx2Identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+	ContainerHeader parseKTX2(const uint8_t* data, size_t size, const std::string& path)
+	{
+		const size_t levelIndexStart = 80;
+
+		if (size < levelIndexStart || memcmp(data, ktx2Identifier, sizeof(ktx2Identifier)) != 0)
+			throw std::runtime_error("Invalid KTX2 header. Path = " + path);
+
+		vk::Format format = static_cast<vk::Format>(read<uint32_t>(data, 12));
+		uint32_t width = read<uint32_t>(data, 20);
+		uint32_t height = std::max(read<uint32_t>(data, 24), 1u);
+		uint32_t depth = read<uint32_t>(data, 28);
+		uint32_t faces = read<uint32_t>(data, 36);
+		uint32_t mipCount = std::max(read<uint32_t>(data, 40), 1u);
+		uint32_t supercompression = read<uint32_t>(data, 44);
+
+		if (width == 0 || mipCount == 0 || mipCount > TextureData::MipLevelCount(width, height))
+			throw std::runtime_error("Invalid KTX2 header. Path = " + path);
+
+		if (depth > 1 || faces != 1 || supercompression != 0)
+			throw std::runtime_error("Only 2D KTX2 textures without supercompression are supported. Path = " + path);
+
+		if (!isSupportedFormat(format))
+			throw std::runtime_error("Unsupported KTX2 format " + vk::to_string(format) + ". Path = " + path);
+
+		ContainerHeader header{ TextureInfo{ width, height, format, mipCount }, levelChain(format, width, height, mipCount) };
+
+		if (size < levelIndexStart + static_cast<size_t>(mipCount) * 24)
+			throw std::runtime_error("Texture file is truncated. Path = " + path);
+
+		// Only the first layer of array textures is used, it is at the start of each level.
+		for (uint32_t level = 0; level < mipCount; ++level)
+			header.levels[level].offset = static_cast<size_t>(read<uint64_t>(data, levelIndexStart + level * 24));
+
+		return header;
+	}
+
+	// Cooked textures are a 24 byte header (magic, version, VkFormat, width, height, level count)
+	// followed by an offset/size pair per level. Levels are tightly packed and start on a 16 byte boundary.
+	const uint32_t cookedMagic = fourCC('V', 'K', 'T', 'X');
+	const uint32_t cookedVersion = 1;
+	const size_t cookedHeaderSize = 24;
+	const size_t cookedLevelAlignment = 16;
+
+	ContainerHeader parseCooked(const uint8_t* data, size_t size, const std::string& path)
+	{
+		if (size < cookedHeaderSize || read<uint32_t>(data, 0) != cookedMagic)
+			throw std::runtime_error("Invalid cooked texture header. Path = " + path);
+		if (read<uint32_t>(data, 4) != cookedVersion)
+			throw std::runtime_error("Cooked texture was made by a different version of texcook. Path = " + path);
+
+		vk::Format format = static_cast<vk::Format>(read<uint32_t>(data, 8));
+		uint32_t width = read<uint32_t>(data, 12);
+		uint32_t height = read<uint32_t>(data, 16);
+		uint32_t mipCount = read<uint32_t>(data, 20);
+
+		if (!isSupportedFormat(format))
+			throw std::runtime_error("Unsupported cooked texture format " + vk::to_string(format) + ". Path = " + path);
+		if (width == 0 || height == 0 || mipCount == 0 || mipCount > TextureData::MipLevelCount(width, height))
+			throw std::runtime_error("Invalid cooked texture extent. Path = " + path);
+		if (size < cookedHeaderSize + mipCount * 2 * sizeof(uint64_t))
+			throw std::runtime_error("Cooked texture is truncated. Path = " + path);
+
+		ContainerHeader header{ TextureInfo{ width, height, format, mipCount }, levelChain(format, width, height, mipCount) };
+		for (uint32_t level = 0; level < mipCount; ++level)
+		{
+			size_t entry = cookedHeaderSize + level * 2 * sizeof(uint64_t);
+			if (read<uint64_t>(data, entry + sizeof(uint64_t)) != header.levels[level].size)
+				throw std::runtime_error("Cooked texture level has the wrong size. Path = " + path);
+
+			header.levels[level].offset = static_cast<size_t>(read<uint64_t>(data, entry));
+		}
+
+		return header;
+	}
+
+	ContainerHeader parseContainer(const uint8_t* data, size_t size, const std::string& path)
+	{
+		if (hasExtension(path, ".dds"))
+			return parseDDS(data, size, path);
+		return parseKTX2(data, size, path);
+	}
+
+	bool isContainer(const std::string& path)
+	{
+		return hasExtension(path, ".dds") || hasExtension(path, ".ktx2");
+	}
+
+#pragma region Block Decompression
+
+	void decodeColor565(uint16_t c, uint8_t out[4])
+	{
+		uint8_t r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+		out[0] = (r << 3) | (r >> 2);
+		out[1] = (g << 2) | (g >> 4);
+		out[2] = (b << 3) | (b >> 2);
+		out[3] = 255;
+	}
+
+	void decodeBC1Block(const uint8_t* block, uint8_t out[16][4], bool forceFourColor)
+	{
+		uint16_t c0 = read<uint16_t>(block, 0), c1 = read<uint16_t>(block, 2);
+
+		uint8_t palette[4][4];
+		decodeColor565(c0, palette[0]);
+		decodeColor565(c1, palette[1]);
+
+		for (int c = 0; c < 3; ++c)
+		{
+			if (c0 > c1 || forceFourColor)
+			{
+				palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+				palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+			}
+			else
+			{
+				palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c]) / 2);
+				palette[3][c] = 0;
+			}
+		}
+		palette[2][3] = 255;
+		palette[3][3] = (c0 > c1 || forceFourColor) ? 255 : 0;
+
+		uint32_t indices = read<uint32_t>(block, 4);
+		for (int i = 0; i < 16; ++i)
+			memcpy(out[i], palette[(indices >> (2 * i)) & 3], 4);
+	}
+
+	void decodeBC3Block(const uint8_t* block, uint8_t out[16][4])
+	{
+		decodeBC1Block(block + 8, out, true);
+
+		uint8_t a0 = block[0], a1 = block[1];
+		uint8_t alpha[8] = { a0, a1 };
+		if (a0 > a1)
+		{
+			for (int i = 1; i < 7; ++i)
+				alpha[i + 1] = static_cast<uint8_t>(((7 - i) * a0 + i * a1) / 7);
+		}
+		else
+		{
+			for (int i = 1; i < 5; ++i)
+				alpha[i + 1] = static_cast<uint8_t>(((5 - i) * a0 + i * a1) / 5);
+			alpha[6] = 0;
+			alpha[7] = 255;
+		}
+
+		uint64_t indices = 0;
+		memcpy(&indices, block + 2, 6);
+		for (int i = 0; i < 16; ++i)
+			out[i][3] = alpha[(indices >> (3 * i)) & 7];
+	}
+
+	// Subset of each texel for the 64 two subset partitions, one bit per texel.
+	const uint16_t bc7Partitions2[64] = {
+		0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+		0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+		0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+		0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+		0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+		0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+		0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+		0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+	};
+
+	// Subset of each texel for the 64 three subset partitions, two bits per texel.
+	const uint32_t bc7Partitions3[64] = {
+		0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+		0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+		0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+		0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+		0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+		0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+		0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+		0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254,
+	};
+
+	const uint8_t bc7Anchors2[64] = {
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+		15, 15, 6, 8, 2, 8, 15, 15, 2, 8, 2, 2, 2, 15, 15, 6,
+		6, 2, 6, 8, 15, 15, 2, 2, 15, 15, 15, 15, 15, 2, 2, 15,
+	};
+
+	const uint8_t bc7Anchors3a[64] = {
+		3, 3, 15, 15, 8, 3, 15, 15, 8, 8, 6, 6, 6, 5, 3, 3,
+		3, 3, 8, 15, 3, 3, 6, 10, 5, 8, 8, 6, 8, 5, 15, 15,
+		8, 15, 3, 5, 6, 10, 8, 15, 15, 3, 15, 5, 15, 15, 15, 15,
+		3, 15, 5, 5, 5, 8, 5, 10, 5, 10, 8, 13, 15, 12, 3, 3,
+	};
+
+	const uint8_t bc7Anchors3b[64] = {
+		15, 8, 8, 3, 15, 15, 3, 8, 15, 15, 15, 15, 15, 15, 15, 8,
+		15, 8, 15, 3, 15, 8, 15, 8, 3, 15, 6, 10, 15, 15, 10, 8,
+		15, 3, 15, 10, 10, 8, 9, 10, 6, 15, 8, 15, 3, 6, 6, 8,
+		15, 3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 3, 15, 15, 8,
+	};
+
+	const uint8_t bc7Weights2[4] = { 0, 21, 43, 64 };
+	const uint8_t bc7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+	const uint8_t bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	struct BitReader
+	{
+		const uint8_t* data;
+		uint32_t pos;
+
+		uint32_t read(uint32_t nBits)
+		{
+			uint32_t value = 0;
+			for (uint32_t i = 0; i < nBits; ++i, ++pos)
+				value |= ((data[pos >> 3] >> (pos & 7)) & 1u) << i;
+			return value;
+		}
+	};
+
+	uint8_t bc7Interpolate(uint8_t e0, uint8_t e1, uint32_t index, uint32_t indexBits)
+	{
+		const uint8_t* weights = indexBits == 2 ? bc7Weights2 : indexBits == 3 ? bc7Weights3 : bc7Weights4;
+		return static_cast<uint8_t>(((64 - weights[index]) * e0 + weights[index] * e1 + 32) >> 6);
+	}
+
+	void decodeBC7Block(const uint8_t* block, uint8_t out[16][4])
+	{
+		struct ModeInfo
+		{
+			uint8_t subsets, partitionBits, rotationBits, indexSelectionBits, colorBits, alphaBits, endpointPBits, sharedPBits, indexBits, indexBits2;
+		};
+		static const ModeInfo modes[8] = {
+			{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+			{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+			{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+			{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+			{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+			{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+			{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+			{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+		};
+
+		uint32_t mode = 0;
+		while (mode < 8 && !(block[0] & (1 << mode)))
+			++mode;
+
+		if (mode == 8) // Reserved, decodes as transparent black.
+		{
+			memset(out, 0, 16 * 4);
+			return;
+		}
+
+		const ModeInfo& info = modes[mode];
+		BitReader bits{ block, mode + 1 };
+
+		uint32_t partition = bits.read(info.partitionBits);
+		uint32_t rotation = bits.read(info.rotationBits);
+		uint32_t indexSelection = bits.read(info.indexSelectionBits);
+
+		uint32_t nEndpoints = info.subsets * 2u;
+		uint8_t endpoints[6][4];
+
+		for (uint32_t c = 0; c < 3; ++c)
+			for (uint32_t e = 0; e < nEndpoints; ++e)
+				endpoints[e][c] = static_cast<uint8_t>(bits.read(info.colorBits));
+		for (uint32_t e = 0; e < nEndpoints; ++e)
+			endpoints[e][3] = static_cast<uint8_t>(bits.read(info.alphaBits));
+
+		uint32_t colorBits = info.colorBits, alphaBits = info.alphaBits;
+		if (info.endpointPBits || info.sharedPBits)
+		{
+			uint32_t pBits[6];
+			if (info.endpointPBits)
+			{
+				for (uint32_t e = 0; e < nEndpoints; ++e)
+					pBits[e] = bits.read(1);
+			}
+			else
+			{
+				for (uint32_t s = 0; s < info.subsets; ++s)
+					pBits[2 * s] = pBits[2 * s + 1] = bits.read(1);
+			}
+
+			for (uint32_t e = 0; e < nEndpoints; ++e)
+				for (uint32_t c = 0; c < 4; ++c)
+					endpoints[e][c] = static_cast<uint8_t>((endpoints[e][c] << 1) | pBits[e]);
+
+			colorBits++;
+			if (alphaBits) alphaBits++;
+		}
+
+		for (uint32_t e = 0; e < nEndpoints; ++e)
+		{
+			for (uint32_t c = 0; c < 3; ++c)
+				endpoints[e][c] = static_cast<uint8_t>((endpoints[e][c] << (8 - colorBits)) | (endpoints[e][c] >> (2 * colorBits - 8)));
+
+			endpoints[e][3] = alphaBits
+				? static_cast<uint8_t>((endpoints[e][3] << (8 - alphaBits)) | (endpoints[e][3] >> (2 * alphaBits - 8)))
+				: 255;
+		}
+
+		auto subsetOf = [&](uint32_t i) -> uint32_t
+		{
+			if (info.subsets == 2) return (bc7Partitions2[partition] >> i) & 1;
+			if (info.subsets == 3) return (bc7Partitions3[partition] >> (2 * i)) & 3;
+			return 0;
+		};
+		auto isAnchor = [&](uint32_t i) -> bool
+		{
+			if (i == 0) return true;
+			if (info.subsets == 2) return i == bc7Anchors2[partition];
+			if (info.subsets == 3) return i == bc7Anchors3a[partition] || i == bc7Anchors3b[partition];
+			return false;
+		};
+
+		uint32_t indices[16], indices2[16];
+		for (uint32_t i = 0; i < 16; ++i)
+			indices[i] = bits.read(info.indexBits - (isAnchor(i) ? 1 : 0));
+		if (info.indexBits2)
+		{
+			for (uint32_t i = 0; i < 16; ++i)
+				indices2[i] = bits.read(info.indexBits2 - (i == 0 ? 1 : 0));
+		}
+
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			const uint8_t* e0 = endpoints[2 * subsetOf(i)];
+			const uint8_t* e1 = endpoints[2 * subsetOf(i) + 1];
+
+			uint32_t colorIndex = indices[i], colorIndexBits = info.indexBits;
+			uint32_t alphaIndex = indices[i], alphaIndexBits = info.indexBits;
+			if (info.indexBits2)
+			{
+				if (indexSelection)
+				{
+					colorIndex = indices2[i];
+					colorIndexBits = info.indexBits2;
+				}
+				else
+				{
+					alphaIndex = indices2[i];
+					alphaIndexBits = info.indexBits2;
+				}
+			}
+
+			for (uint32_t c = 0; c < 3; ++c)
+				out[i][c] = bc7Interpolate(e0[c], e1[c], colorIndex, colorIndexBits);
+			out[i][3] = bc7Interpolate(e0[3], e1[3], alphaIndex, alphaIndexBits);
+
+			if (rotation)
+				std::swap(out[i][3], out[i][rotation - 1]);
+		}
+	}
+
+#pragma endregion
+
+#pragma region Block Compression
+
+	uint16_t encodeColor565(const uint8_t color[3])
+	{
+		return static_cast<uint16_t>(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+	}
+
+	// Endpoints are the corners of the colour bounding box, inset slightly since the extremes are rarely worth a palette entry of their own.
+	void encodeBC1Block(const uint8_t texels[16][4], uint8_t* block)
+	{
+		uint8_t minColor[3] = { 255, 255, 255 }, maxColor[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				minColor[c] = std::min(minColor[c], texels[i][c]);
+				maxColor[c] = std::max(maxColor[c], texels[i][c]);
+			}
+		}
+		for (int c = 0; c < 3; ++c)
+		{
+			uint8_t inset = static_cast<uint8_t>((maxColor[c] - minColor[c]) >> 4);
+			minColor[c] += inset;
+			maxColor[c] -= inset;
+		}
+
+		// Every channel of maxColor is >= minColor so c0 >= c1, which keeps the block in four colour mode unless they are equal.
+		uint16_t c0 = encodeColor565(maxColor), c1 = encodeColor565(minColor);
+		memcpy(block, &c0, 2);
+		memcpy(block + 2, &c1, 2);
+
+		uint32_t indices = 0;
+		if (c0 != c1)
+		{
+			uint8_t palette[4][4];
+			decodeColor565(c0, palette[0]);
+			decodeColor565(c1, palette[1]);
+			for (int c = 0; c < 3; ++c)
+			{
+				palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+				palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+			}
+
+			for (int i = 0; i < 16; ++i)
+			{
+				uint32_t best = 0, bestDistance = std::numeric_limits<uint32_t>::max();
+				for (uint32_t p = 0; p < 4; ++p)
+				{
+					uint32_t distance = 0;
+					for (int c = 0; c < 3; ++c)
+						distance += (texels[i][c] - palette[p][c]) * (texels[i][c] - palette[p][c]);
+					if (distance < bestDistance)
+					{
+						best = p;
+						bestDistance = distance;
+					}
+				}
+				indices |= best << (2 * i);
+			}
+		}
+		memcpy(block + 4, &indices, 4);
+	}
+
+	void encodeBC3Block(const uint8_t texels[16][4], uint8_t* block)
+	{
+		uint8_t a0 = 0, a1 = 255;
+		for (int i = 0; i < 16; ++i)
+		{
+			a0 = std::max(a0, texels[i][3]);
+			a1 = std::min(a1, texels[i][3]);
+		}
+		block[0] = a0;
+		block[1] = a1;
+
+		uint64_t indices = 0;
+		if (a0 != a1)
+		{
+			// a0 > a1 selects the eight value interpolated palette.
+			uint8_t alpha[8] = { a0, a1 };
+			for (int i = 1; i < 7; ++i)
+				alpha[i + 1] = static_cast<uint8_t>(((7 - i) * a0 + i * a1) / 7);
+
+			for (int i = 0; i < 16; ++i)
+			{
+				uint64_t best = 0;
+				int bestDistance = 256;
+				for (uint64_t p = 0; p < 8; ++p)
+				{
+					int distance = std::abs(texels[i][3] - alpha[p]);
+					if (distance < bestDistance)
+					{
+						best = p;
+						bestDistance = distance;
+					}
+				}
+				indices |= best << (3 * i);
+			}
+		}
+		memcpy(block + 2, &indices, 6);
+
+		encodeBC1Block(texels, block + 8);
+	}
+
+#pragma endregion
+}
+
+TextureData TextureData::Load(std::string path)
+{
+	if (hasExtension(path, CookedExtension))
+	{
+		auto mapping = std::make_shared<const MappedFile>(MappedFile::Open(path));
+		ContainerHeader header = parseCooked(mapping->data(), mapping->size(), path);
+
+		for (auto& level : header.levels)
+		{
+			if (level.offset + level.size > mapping->size())
+				throw std::runtime_error("Texture file is truncated. Path = " + path);
+		}
+
+		return { std::move(path), header.info.format, std::move(header.levels), std::move(mapping) };
+	}
+
+	if (isContainer(path))
+	{
+		std::vector<uint8_t> file = readFile(path);
+		ContainerHeader header = parseContainer(file.data(), file.size(), path);
+
+		size_t totalSize = 0;
+		for (auto& level : header.levels)
+		{
+			if (level.offset + level.size > file.size())
+				throw std::runtime_error("Texture file is truncated. Path = " + path);
+			totalSize += level.size;
+		}
+
+		// Repack the levels tightly, containers may pad or reorder them.
+		std::vector<uint8_t> data(totalSize);
+		size_t offset = 0;
+		for (auto& level : header.levels)
+		{
+			memcpy(data.data() + offset, file.data() + level.offset, level.size);
+			level.offset = offset;
+			offset += level.size;
+		}
+
+		return { std::move(path), header.info.format, std::move(header.levels), std::move(data) };
+	}
+
+	int width, height, channels;
+
+	using unique_image = std::unique_ptr<stbi_uc, void(*)(void*)>;
+	unique_image pixels = unique_image{ stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha), stbi_image_free };
+
+	if (!pixels) throw std::runtime_error("Image file not found. Path = " + path);
+
+	size_t size = static_cast<size_t>(width) * height * sizeof(uint32_t);
+
+	std::vector<uint8_t> data(pixels.get(), pixels.get() + size);
+	std::vector<TextureLevel> levels{ TextureLevel{ static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0, size } };
+
+	return { std::move(path), vk::Format::eR8G8B8A8Unorm, std::move(levels), std::move(data) };
+}
+
+TextureData TextureData::Solid(std::string name, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+	std::vector<TextureLevel> levels{ TextureLevel{ 1, 1, 0, 4 } };
+	return { std::move(name), vk::Format::eR8G8B8A8Unorm, std::move(levels), std::vector<uint8_t>{ r, g, b, a } };
+}
+
+TextureInfo TextureData::Probe(const std::string& path)
+{
+	if (hasExtension(path, CookedExtension))
+	{
+		std::vector<uint8_t> header = readFile(path, 1024);
+		return parseCooked(header.data(), header.size(), path).info;
+	}
+
+	if (isContainer(path))
+	{
+		std::vector<uint8_t> header = readFile(path, 1024);
+		return parseContainer(header.data(), header.size(), path).info;
+	}
+
+	int width, height, channels;
+	if (!stbi_info(path.c_str(), &width, &height, &channels))
+		throw std::runtime_error("Image file not found. Path = " + path);
+
+	return TextureInfo{ static_cast<uint32_t>(width), static_cast<uint32_t>(height), vk::Format::eR8G8B8A8Unorm, 1 };
+}
+
+uint32_t TextureData::MipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+		++levels;
+	return levels;
+}
+
+bool TextureData::IsBlockCompressed(vk::Format format)
+{
+	switch (format)
+	{
+	case vk::Format::eBc1RgbaUnormBlock:
+	case vk::Format::eBc1RgbaSrgbBlock:
+	case vk::Format::eBc3UnormBlock:
+	case vk::Format::eBc3SrgbBlock:
+	case vk::Format::eBc7UnormBlock:
+	case vk::Format::eBc7SrgbBlock:
+		return true;
+	default:
+		return false;
+	}
+}
+
+size_t TextureData::LevelSize(vk::Format format, uint32_t width, uint32_t height)
+{
+	if (!IsBlockCompressed(format))
+		return static_cast<size_t>(width) * height * sizeof(uint32_t);
+
+	size_t blockSize = (format == vk::Format::eBc1RgbaUnormBlock || format == vk::Format::eBc1RgbaSrgbBlock) ? 8 : 16;
+	return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+}
+
+void TextureData::generateMips()
+{
+	if (m_format != vk::Format::eR8G8B8A8Unorm && m_format != vk::Format::eR8G8B8A8Srgb)
+		throw std::runtime_error("CPU mip generation only supports RGBA8. Path = " + m_path);
+
+	unmap();
+
+	uint32_t nLevels = MipLevelCount(width(), height());
+
+	m_levels = levelChain(m_format, width(), height(), nLevels);
+	m_data.resize(m_levels.back().offset + m_levels.back().size);
+
+	for (size_t level = 1; level < m_levels.size(); ++level)
+	{
+		const TextureLevel& src = m_levels[level - 1];
+		const TextureLevel& dst = m_levels[level];
+
+		const uint8_t* srcData = m_data.data() + src.offset;
+		uint8_t* dstData = m_data.data() + dst.offset;
+
+		for (uint32_t y = 0; y < dst.height; ++y)
+		{
+			// Odd sized levels clamp the second tap onto the last row/column.
+			uint32_t y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+
+			for (uint32_t x = 0; x < dst.width; ++x)
+			{
+				uint32_t x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+
+				for (uint32_t c = 0; c < 4; ++c)
+				{
+					uint32_t sum = srcData[(y0 * src.width + x0) * 4 + c]
+						+ srcData[(y0 * src.width + x1) * 4 + c]
+						+ srcData[(y1 * src.width + x0) * 4 + c]
+						+ srcData[(y1 * src.width + x1) * 4 + c];
+
+					dstData[(y * dst.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+void TextureData::decompress()
+{
+	if (!IsBlockCompressed(m_format)) return;
+
+	bool srgb = m_format == vk::Format::eBc1RgbaSrgbBlock || m_format == vk::Format::eBc3SrgbBlock || m_format == vk::Format::eBc7SrgbBlock;
+	vk::Format format = srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+
+	std::vector<TextureLevel> levels = levelChain(format, width(), height(), static_cast<uint32_t>(m_levels.size()));
+	std::vector<uint8_t> data(levels.back().offset + levels.back().size);
+
+	size_t blockSize = LevelSize(m_format, 1, 1);
+
+	for (size_t level = 0; level < levels.size(); ++level)
+	{
+		const TextureLevel& src = m_levels[level];
+		const TextureLevel& dst = levels[level];
+
+		uint32_t blocksX = (src.width + 3) / 4, blocksY = (src.height + 3) / 4;
+
+		for (uint32_t by = 0; by < blocksY; ++by)
+		{
+			for (uint32_t bx = 0; bx < blocksX; ++bx)
+			{
+				const uint8_t* block = pixels() + src.offset + (by * blocksX + bx) * blockSize;
+
+				uint8_t texels[16][4];
+				switch (m_format)
+				{
+				case vk::Format::eBc1RgbaUnormBlock:
+				case vk::Format::eBc1RgbaSrgbBlock:
+					decodeBC1Block(block, texels, false);
+					break;
+				case vk::Format::eBc3UnormBlock:
+				case vk::Format::eBc3SrgbBlock:
+					decodeBC3Block(block, texels);
+					break;
+				default:
+					decodeBC7Block(block, texels);
+					break;
+				}
+
+				// Blocks on the right/bottom edge of odd sized levels hang over the image.
+				for (uint32_t y = 0; y < 4 && by * 4 + y < dst.height; ++y)
+				{
+					for (uint32_t x = 0; x < 4 && bx * 4 + x < dst.width; ++x)
+					{
+						memcpy(data.data() + dst.offset + ((by * 4 + y) * dst.width + bx * 4 + x) * 4, texels[y * 4 + x], 4);
+					}
+				}
+			}
+		}
+	}
+
+	m_format = format;
+	m_levels = std::move(levels);
+	m_data = std::move(data);
+	m_mapping.reset();
+}
+
+void TextureData::compress(vk::Format format)
+{
+	bool bc3 = format == vk::Format::eBc3UnormBlock || format == vk::Format::eBc3SrgbBlock;
+	if (!bc3 && format != vk::Format::eBc1RgbaUnormBlock && format != vk::Format::eBc1RgbaSrgbBlock)
+		throw std::runtime_error("Only BC1 and BC3 encoding is supported, requested " + vk::to_string(format) + ". Path = " + m_path);
+	if (m_format != vk::Format::eR8G8B8A8Unorm && m_format != vk::Format::eR8G8B8A8Srgb)
+		throw std::runtime_error("Block compression only supports RGBA8 sources. Path = " + m_path);
+
+	if (m_format == vk::Format::eR8G8B8A8Srgb)
+		format = bc3 ? vk::Format::eBc3SrgbBlock : vk::Format::eBc1RgbaSrgbBlock;
+
+	std::vector<TextureLevel> levels = levelChain(format, width(), height(), static_cast<uint32_t>(m_levels.size()));
+	std::vector<uint8_t> data(levels.back().offset + levels.back().size);
+
+	size_t blockSize = LevelSize(format, 1, 1);
+
+	for (size_t level = 0; level < levels.size(); ++level)
+	{
+		const TextureLevel& src = m_levels[level];
+		const TextureLevel& dst = levels[level];
+
+		const uint8_t* srcData = pixels() + src.offset;
+		uint32_t blocksX = (src.width + 3) / 4, blocksY = (src.height + 3) / 4;
+
+		for (uint32_t by = 0; by < blocksY; ++by)
+		{
+			for (uint32_t bx = 0; bx < blocksX; ++bx)
+			{
+				// Edge blocks repeat the last row/column so the padding doesn't skew the endpoints.
+				uint8_t texels[16][4];
+				for (uint32_t y = 0; y < 4; ++y)
+				{
+					uint32_t sy = std::min(by * 4 + y, src.height - 1);
+					for (uint32_t x = 0; x < 4; ++x)
+					{
+						uint32_t sx = std::min(bx * 4 + x, src.width - 1);
+						memcpy(texels[y * 4 + x], srcData + (sy * src.width + sx) * 4, 4);
+					}
+				}
+
+				uint8_t* block = data.data() + dst.offset + (by * blocksX + bx) * blockSize;
+				if (bc3)
+					encodeBC3Block(texels, block);
+				else
+					encodeBC1Block(texels, block);
+			}
+		}
+	}
+
+	m_format = format;
+	m_levels = std::move(levels);
+	m_data = std::move(data);
+	m_mapping.reset();
+}
+
+void TextureData::save(const std::string& path) const
+{
+	size_t tableSize = cookedHeaderSize + m_levels.size() * 2 * sizeof(uint64_t);
+
+	std::vector<uint8_t> header(tableSize);
+	auto write = [&](size_t offset, auto value) { memcpy(header.data() + offset, &value, sizeof(value)); };
+
+	write(0, cookedMagic);
+	write(4, cookedVersion);
+	write(8, static_cast<uint32_t>(m_format));
+	write(12, width());
+	write(16, height());
+	write(20, static_cast<uint32_t>(m_levels.size()));
+
+	std::vector<uint64_t> offsets;
+	size_t offset = tableSize;
+	for (size_t level = 0; level < m_levels.size(); ++level)
+	{
+		offset = align_offset(offset, cookedLevelAlignment);
+		offsets.push_back(offset);
+
+		write(cookedHeaderSize + level * 2 * sizeof(uint64_t), static_cast<uint64_t>(offset));
+		write(cookedHeaderSize + level * 2 * sizeof(uint64_t) + sizeof(uint64_t), static_cast<uint64_t>(m_levels[level].size));
+
+		offset += m_levels[level].size;
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) throw std::runtime_error("Failed to open texture for writing. Path = " + path);
+
+	file.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+	const char padding[cookedLevelAlignment] = {};
+	size_t written = header.size();
+	for (size_t level = 0; level < m_levels.size(); ++level)
+	{
+		file.write(padding, offsets[level] - written);
+		file.write(reinterpret_cast<const char*>(pixels() + m_levels[level].offset), m_levels[level].size);
+		written = offsets[level] + m_levels[level].size;
+	}
+
+	if (!file) throw std::runtime_error("Failed to write texture. Path = " + path);
+}
+
+void TextureData::unmap()
+{
+	if (!m_mapping) return;
+
+	size_t totalSize = 0;
+	for (auto& level : m_levels)
+		totalSize += level.size;
+
+	std::vector<uint8_t> data(totalSize);
+	size_t offset = 0;
+	for (auto& level : m_levels)
+	{
+		memcpy(data.data() + offset, m_mapping->data() + level.offset, level.size);
+		level.offset = offset;
+		offset += level.size;
+	}
+
+	m_data = std::move(data);
+	m_mapping.reset();
+}
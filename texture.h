@@ -0,0 +1,114 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <vulkan/vulkan.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+struct TextureLevel
+{
+	uint32_t width;
+	uint32_t height;
+	size_t offset;
+	size_t size;
+};
+
+struct TextureInfo
+{
+	uint32_t width;
+	uint32_t height;
+	vk::Format format;
+	uint32_t levels;
+};
+
+// CPU side copy of a texture's pixels, level 0 first followed by any smaller mip levels.
+// Images are decoded with stb_image, .dds and .ktx2 files are read as is (RGBA8, BC1, BC3 or BC7).
+// Cooked .vktex files (see texcook.cpp) are memory mapped and never copied until they reach a staging buffer.
+class TextureData
+{
+public:
+	static constexpr const char* CookedExtension = ".vktex";
+
+	static TextureData Load(std::string path);
+
+	// Single RGBA8 texel, used as a stand in while the real texture streams in.
+	static TextureData Solid(std::string name, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+
+	// Reads only the file header, enough to group textures before decoding them.
+	static TextureInfo Probe(const std::string& path);
+
+	static uint32_t MipLevelCount(uint32_t width, uint32_t height);
+	static bool IsBlockCompressed(vk::Format format);
+	static size_t LevelSize(vk::Format format, uint32_t width, uint32_t height);
+
+	// Fills in the remaining mip chain with a 2x2 box filter, for formats the device can't blit.
+	void generateMips();
+
+	// Decodes block compressed levels to RGBA8, for devices that can't sample the compressed format.
+	void decompress();
+
+	// Encodes RGBA8 levels as BC1 (alpha is dropped) or BC3.
+	void compress(vk::Format format);
+
+	// Writes every level to a cooked .vktex file that Load can map straight back in.
+	void save(const std::string& path) const;
+
+	const std::string& path() const
+	{
+		return m_path;
+	}
+	vk::Format format() const
+	{
+		return m_format;
+	}
+	uint32_t width() const
+	{
+		return m_levels.front().width;
+	}
+	uint32_t height() const
+	{
+		return m_levels.front().height;
+	}
+	const std::vector<TextureLevel>& levels() const
+	{
+		return m_levels;
+	}
+	// Level offsets are relative to this, which points into the mapped file for cooked textures.
+	const uint8_t* pixels() const
+	{
+		return m_mapping ? m_mapping->data() : m_data.data();
+	}
+
+private:
+
+	TextureData(std::string path, vk::Format format, std::vector<TextureLevel> levels, std::vector<uint8_t> data) :
+		m_path(std::move(path)),
+		m_format(format),
+		m_levels(std::move(levels)),
+		m_data(std::move(data))
+	{}
+
+	TextureData(std::string path, vk::Format format, std::vector<TextureLevel> levels, std::shared_ptr<const MappedFile> mapping) :
+		m_path(std::move(path)),
+		m_format(format),
+		m_levels(std::move(levels)),
+		m_mapping(std::move(mapping))
+	{}
+
+	// Copies mapped levels into m_data so they can be modified.
+	void unmap();
+
+	std::string m_path;
+	vk::Format m_format;
+	std::vector<TextureLevel> m_levels;
+	std::vector<uint8_t> m_data;
+	std::shared_ptr<const MappedFile> m_mapping;
+};
+
+#endif
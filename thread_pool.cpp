@@ -0,0 +1,43 @@
+#include "stdafx.h"
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t nThreads)
+{
+	m_threads.reserve(nThreads);
+	for (size_t i = 0; i < nThreads; ++i)
+		m_threads.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_condition.notify_all();
+
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+void ThreadPool::worker()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+			// Queued work is still finished on shutdown so no future is left without a value.
+			if (m_tasks.empty())
+				return;
+
+			task = std::move(m_tasks.front());
+			m_tasks.pop();
+		}
+
+		task();
+	}
+}
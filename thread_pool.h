@@ -0,0 +1,81 @@
+#ifdef _MSC_VER
+#	pragma once
+#endif
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued tasks in submission order.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(size_t nThreads = std::max(1u, std::thread::hardware_concurrency()));
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	template<typename F>
+	auto submit(F&& f) -> std::future<decltype(f())>
+	{
+		using Result = decltype(f());
+
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+		std::future<Result> future = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_tasks.emplace([task]() { (*task)(); });
+		}
+		m_condition.notify_one();
+
+		return future;
+	}
+
+	// Splits [0, count) into a chunk per thread and calls f(begin, end) on each, returns when all are done.
+	// Must not be called from one of the pool's own tasks, it would wait on itself.
+	template<typename F>
+	void parallelFor(size_t count, F&& f)
+	{
+		size_t chunk = (count + m_threads.size() - 1) / m_threads.size();
+
+		std::vector<std::future<void>> chunks;
+		for (size_t begin = 0; begin < count; begin += chunk)
+		{
+			size_t end = std::min(begin + chunk, count);
+			chunks.push_back(submit([&f, begin, end]() { f(begin, end); }));
+		}
+
+		// Every chunk has to finish before an exception leaves, they all reference f.
+		for (auto& c : chunks)
+			c.wait();
+		for (auto& c : chunks)
+			c.get();
+	}
+
+	size_t size() const
+	{
+		return m_threads.size();
+	}
+
+private:
+
+	void worker();
+
+	std::vector<std::thread> m_threads;
+	std::queue<std::function<void()>> m_tasks;
+
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_stopping = false;
+};
+
+#endif
@@ -1,3 +1,99 @@
 #include "stdafx.h"
 #include "window.h"
 
+#include <thread>
+
+namespace
+{
+	// How soon input left over by a full queue is pushed again.
+	const double retryInterval = 0.001;
+}
+
+Window::Window(uint32_t width, uint32_t height, const char* title)
+{
+	if (!glfwInit()) throw std::runtime_error("Couldn't initialize GLFW.");
+
+	glfwWindowHint(GLFW_RESIZABLE, false);
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+	m_window = glfwCreateWindow(width, height, title, nullptr, nullptr);
+	if (!m_window)
+	{
+		glfwTerminate();
+		throw std::runtime_error("Couldn't create window.");
+	}
+
+	glfwSetWindowUserPointer(m_window, this);
+
+	glfwSetInputMode(m_window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	glfwSetCursorPosCallback(m_window, CursorMoved);
+}
+
+Window::~Window()
+{
+	glfwDestroyWindow(m_window);
+	glfwTerminate();
+}
+
+void Window::CursorMoved(GLFWwindow* window, double x, double y)
+{
+	Window* self = reinterpret_cast<Window*>(glfwGetWindowUserPointer(window));
+	self->m_cursor = glm::vec2(x, y);
+	self->m_cursorPending = true;
+}
+
+void Window::run(RenderCommandQueue& commands)
+{
+	bool flushed = true;
+
+	while (!m_closing && !glfwWindowShouldClose(m_window))
+	{
+		// Sleeps until there is input, or until left over commands can be tried again.
+		if (flushed)
+			glfwWaitEvents();
+		else
+			glfwWaitEventsTimeout(retryInterval);
+
+		if (glfwGetKey(m_window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+			glfwSetWindowShouldClose(m_window, GLFW_TRUE);
+
+		uint32_t moveKeys = 0;
+		if (glfwGetKey(m_window, GLFW_KEY_W) == GLFW_PRESS)
+			moveKeys |= RenderCommand::Forward;
+		if (glfwGetKey(m_window, GLFW_KEY_S) == GLFW_PRESS)
+			moveKeys |= RenderCommand::Back;
+		if (glfwGetKey(m_window, GLFW_KEY_A) == GLFW_PRESS)
+			moveKeys |= RenderCommand::Left;
+		if (glfwGetKey(m_window, GLFW_KEY_D) == GLFW_PRESS)
+			moveKeys |= RenderCommand::Right;
+
+		if (moveKeys != m_moveKeys)
+		{
+			m_moveKeys = moveKeys;
+			m_moveKeysPending = true;
+		}
+
+		flushed = flush(commands);
+	}
+
+	// The render thread may be behind, but it has to see this one. After close() it has stopped already.
+	RenderCommand quit{ RenderCommand::Type::Quit };
+	while (!m_closing && !commands.tryPush(quit))
+		std::this_thread::yield();
+}
+
+void Window::close()
+{
+	m_closing = true;
+	glfwPostEmptyEvent();
+}
+
+bool Window::flush(RenderCommandQueue& commands)
+{
+	if (m_cursorPending && commands.tryPush(RenderCommand{ RenderCommand::Type::Look, m_cursor }))
+		m_cursorPending = false;
+	if (m_moveKeysPending && commands.tryPush(RenderCommand{ RenderCommand::Type::Move, {}, m_moveKeys }))
+		m_moveKeysPending = false;
+
+	return !m_cursorPending && !m_moveKeysPending;
+}
@@ -5,12 +5,70 @@
 #define WINDOW_H
 
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <atomic>
+#include "spsc_queue.h"
 
+// Input handed from the window thread to the render thread.
+struct RenderCommand
+{
+	enum class Type
+	{
+		Look, // The cursor moved to cursor.
+		Move, // The held movement keys are now moveKeys.
+		Quit
+	};
+
+	enum MoveKey : uint32_t
+	{
+		Forward = 1,
+		Back = 2,
+		Left = 4,
+		Right = 8
+	};
+
+	Type type;
+	glm::vec2 cursor;
+	uint32_t moveKeys;
+};
+
+using RenderCommandQueue = SpscQueue<RenderCommand, 1024>;
+
+// The GLFW window and its input, owned by the main thread. GLFW wants its events handled there, rendering happens elsewhere.
 class Window
 {
+public:
+	Window(uint32_t width, uint32_t height, const char* title);
+	~Window();
 
+	Window(const Window&) = delete;
+	Window& operator=(const Window&) = delete;
 
+	// Handles events until the window is closed or close() is called, turning the input into commands.
+	// Ends by pushing a Quit command when the window was closed.
+	void run(RenderCommandQueue& commands);
+	// Makes run() return without a Quit command, for when the render thread stopped on its own. Callable from any thread.
+	void close();
 
+	GLFWwindow* handle() const
+	{
+		return m_window;
+	}
+
+private:
+	static void CursorMoved(GLFWwindow* window, double x, double y);
+
+	// Pushes what couldn't be pushed before, true when nothing is left over.
+	bool flush(RenderCommandQueue& commands);
+
+	GLFWwindow* m_window = nullptr;
+	std::atomic<bool> m_closing{ false };
+
+	// Latest input not pushed yet, a full queue only delays it. Cursor positions are absolute, so dropping the ones in between loses nothing.
+	bool m_cursorPending = false;
+	glm::vec2 m_cursor{ 0.0f };
+	bool m_moveKeysPending = false;
+	uint32_t m_moveKeys = 0;
 };
 
-#endif
\ No newline at end of file
+#endif